@@ -0,0 +1,233 @@
+#define _DEFAULT_SOURCE
+
+#include "batch.h"
+#include "quirks.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static size_t
+round_up(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+//.. File holding a group of instances laid out like the batch, each a copy
+//   of `snapshot`. It's unlinked right away, the mappings of it keep it alive.
+//   Returns -1 on failure.
+static int
+create_group_file(const struct Batch* batch, const struct VM* snapshot)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/chip8-batch-%ld", (long) getpid());
+
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+    shm_unlink(name);
+
+    if (ftruncate(fd, batch->file_size) != 0)
+        goto error;
+
+    const size_t size = vm_size(snapshot->quirks);
+    for (size_t slot = 0; slot < batch->group_size; slot++) {
+        const off_t offset = batch->offset + slot * batch->stride;
+        for (size_t written = 0; written < size;) {
+            const ssize_t result = pwrite(
+                fd, (const uint8_t*) snapshot + written, size - written, offset + written
+            );
+            if (result <= 0)
+                goto error;
+            written += result;
+        }
+    }
+
+    return fd;
+
+    error:
+        close(fd);
+        return -1;
+}
+
+//.. `count` instances in the state of `snapshot`, which has to be one
+//   (see vm_snapshot()). With `shared`, every group of instances is one
+//   copy-on-write mapping of the group file.
+enum Error
+batch_init(struct Batch* batch, const struct VM* snapshot, size_t count, bool shared)
+{
+    assert(snapshot->snapshot_id != 0);
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    *batch = (struct Batch) {
+        .page_size = page_size > 0 ? page_size : 4096,
+        .count = count,
+        .shared = shared,
+    };
+    const size_t memory_size = vm_memory_size(snapshot);
+    const size_t header = round_up(offsetof(struct VM, memory), batch->page_size);
+    batch->offset = header - offsetof(struct VM, memory);
+    batch->stride = header + round_up(memory_size, batch->page_size);
+    batch->mapping_size = batch->stride * count;
+    if (shared) {
+        //.. As many groups as instances per group, up to BATCH_GROUP_SIZE
+        //   instances, so that every page of the file is shared widely
+        batch->group_size = count / BATCH_GROUP_SIZE;
+        if (batch->group_size == 0)
+            batch->group_size = 1;
+        else if (batch->group_size > BATCH_GROUP_SIZE)
+            batch->group_size = BATCH_GROUP_SIZE;
+        batch->file_size = batch->stride * batch->group_size;
+    }
+
+    batch->mapping = mmap(NULL, batch->mapping_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (batch->mapping == MAP_FAILED) {
+        batch->mapping = NULL;
+        return E_OUT_OF_MEMORY;
+    }
+
+    if (!shared) {
+        for (size_t i = 0; i < count; i++)
+            memcpy(batch_instance(batch, i), snapshot, vm_size(snapshot->quirks));
+        return E_OK;
+    }
+
+    const int fd = create_group_file(batch, snapshot);
+    if (fd < 0) {
+        batch_free(batch);
+        return E_BATCH_MAPPING_ERROR;
+    }
+
+    for (size_t first = 0; first < count; first += batch->group_size) {
+        const size_t instances =
+            count - first < batch->group_size ? count - first : batch->group_size;
+        if (mmap(batch->mapping + first * batch->stride, instances * batch->stride,
+                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            close(fd);
+            batch_free(batch);
+            return E_BATCH_MAPPING_ERROR;
+        }
+    }
+
+    close(fd);
+    return E_OK;
+}
+
+//.. Pages of memory an instance wrote since the snapshot
+static size_t
+written_pages(const struct VM* vm, size_t page_size)
+{
+    const size_t chunks_per_page = page_size / MEMORY_CHUNK_SIZE;
+    size_t pages = 0;
+
+    for (size_t first = 0; first < MEMORY_CHUNKS; first += chunks_per_page) {
+        for (size_t chunk = first; chunk < first + chunks_per_page && chunk < MEMORY_CHUNKS; chunk++) {
+            if ((vm->dirty_chunks[chunk / 64] >> (chunk % 64)) & 1) {
+                pages++;
+                break;
+            }
+        }
+    }
+
+    return pages;
+}
+
+//.. Average bytes of memory an instance owns: the pages its state in front of
+//   memory occupies, and all of memory or only the pages it wrote plus its
+//   share of the group file
+size_t
+batch_instance_bytes(const struct Batch* batch)
+{
+    const size_t header = round_up(offsetof(struct VM, memory), batch->page_size);
+    if (!batch->shared || batch->count == 0)
+        return batch->stride;
+
+    size_t pages = 0;
+    for (size_t i = 0; i < batch->count; i++)
+        pages += written_pages(batch_instance(batch, i), batch->page_size);
+
+    return header + (pages * batch->page_size + batch->file_size) / batch->count;
+}
+
+void
+batch_free(struct Batch* batch)
+{
+    if (batch->mapping != NULL)
+        munmap(batch->mapping, batch->mapping_size);
+    batch->mapping = NULL;
+}
+
+//.. Run `count` instances of `vm` for `frames` frames, once with private
+//   memory and once with shared pages, and report memory per instance and
+//   throughput to `out`. `vm` is made a descendant of the snapshot.
+enum Error
+batch_benchmark(struct VM* vm, size_t count, unsigned long frames, FILE* out)
+{
+    struct VM* snapshot;
+    enum Error err = vm_alloc(&snapshot, vm->quirks);
+    if (err != E_OK)
+        return err;
+    vm_snapshot(vm, snapshot);
+
+    bool* halted = malloc(count * sizeof(bool));
+    if (halted == NULL) {
+        free(snapshot);
+        return E_OUT_OF_MEMORY;
+    }
+
+    //.. A VM on its own, as vm_alloc() gives it to the other frontends
+    fprintf(out, "%zu instances, %lu frames each, a %s VM is %zu bytes with a %d byte hot block\n",
+            count, frames, quirks_name(vm->quirks), vm_size(vm->quirks), VM_HOT_BLOCK_SIZE);
+
+    for (int shared = 0; shared <= 1 && err == E_OK; shared++) {
+        struct Batch batch;
+        if ((err = batch_init(&batch, snapshot, count, shared)) != E_OK)
+            break;
+
+        //.. Give every instance its own random sequence
+        for (size_t i = 0; i < count; i++)
+            batch_instance(&batch, i)->random_state += 2 * i;
+        memset(halted, 0, count * sizeof(bool));
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        //.. Frame by frame across all instances, like the grid view runs them
+        for (unsigned long frame = 0; frame < frames; frame++) {
+            for (size_t i = 0; i < count; i++) {
+                if (!halted[i] && vm_run_frame(batch_instance(&batch, i)) != E_OK)
+                    halted[i] = true;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double seconds =
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        uint64_t instructions = 0;
+        size_t halted_count = 0;
+        for (size_t i = 0; i < count; i++) {
+            instructions += batch_instance(&batch, i)->instruction_count;
+            halted_count += halted[i];
+        }
+
+        fprintf(out, "%-14s %8zu bytes per instance, %12.0f frames/s, %8.2f MIPS",
+                shared ? "Shared pages" : "Private memory",
+                batch_instance_bytes(&batch),
+                count * frames / seconds,
+                instructions / seconds / 1e6);
+        if (halted_count > 0)
+            fprintf(out, ", %zu halted", halted_count);
+        fputc('\n', out);
+
+        batch_free(&batch);
+    }
+
+    free(halted);
+    free(snapshot);
+    return err;
+}
@@ -0,0 +1,63 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Many instances of one machine, for running a ROM in bulk.
+ *
+ * Instances are laid out `stride` bytes apart with their memory on a page
+ * boundary. With `shared` set, every run of `group_size` instances is one
+ * private mapping of a file holding that many copies of the snapshot they
+ * start from: the pages of the ROM, the fonts and everything never written
+ * stay shared between the instances in the same slot of every group, and the
+ * kernel copies a page on its first write. What a single instance owns is
+ * then its state in front of memory and the pages it wrote, instead of all
+ * of the profile's memory.
+ *
+ * Every mapping is a VMA of its own, of which the kernel allows
+ * vm.max_map_count (65530 by default) per process. Groups of up to
+ * BATCH_GROUP_SIZE instances keep a batch of a million instances to about
+ * 16000 of them. Running out of mappings anyway is reported as
+ * E_BATCH_MAPPING_ERROR.
+ *
+ * The instances descend from the snapshot (see vm_snapshot()), so their dirty
+ * chunks tell which pages they wrote, and vm_restore() from the snapshot
+ * works as usual.
+ */
+
+//.. Frames run by the benchmark when no count is given
+#define BATCH_FRAMES 600
+//.. Most instances in one mapping of the group file
+#define BATCH_GROUP_SIZE 64
+
+struct Batch {
+    unsigned char* mapping;
+    size_t mapping_size;
+    size_t page_size;
+    //.. Of the first instance, padded so that its memory starts on a page
+    size_t offset;
+    size_t stride;
+    size_t count;
+    //.. Instances per mapping of the group file and its size, 0 without `shared`
+    size_t group_size;
+    size_t file_size;
+    bool shared;
+};
+
+static inline struct VM*
+batch_instance(const struct Batch* batch, size_t index)
+{
+    return (struct VM*) (batch->mapping + batch->offset + index * batch->stride);
+}
+
+enum Error batch_init(struct Batch*, const struct VM* snapshot, size_t count, bool shared);
+size_t     batch_instance_bytes(const struct Batch*);
+void       batch_free(struct Batch*);
+enum Error batch_benchmark(struct VM*, size_t count, unsigned long frames, FILE*);
+
+#endif
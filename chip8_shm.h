@@ -0,0 +1,95 @@
+#ifndef CHIP8_SHM_H_
+#define CHIP8_SHM_H_
+
+/* Public layout of the shared-memory segment written by `chip8 -m <name>`.
+ *
+ * The segment is created with shm_open() under the given name and holds a
+ * single `struct Chip8ShmState`. Consumers map it read-only and copy it out
+ * with chip8_shm_read(), which retries while the emulator is writing; the
+ * emulator never waits for readers.
+ *
+ * The layout only changes together with CHIP8_SHM_VERSION. Consumers should
+ * check `magic`, `version` and `size` before reading anything else. Integers
+ * are in the byte order of the machine, the segment can't leave it anyway.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CHIP8_SHM_MAGIC   0x38504843 /* "CHP8" in little-endian */
+#define CHIP8_SHM_VERSION 3
+
+//.. Largest display, SUPER-CHIP and XO-CHIP high resolution
+#define CHIP8_SHM_DISPLAY_WIDTH  128
+#define CHIP8_SHM_DISPLAY_HEIGHT 64
+#define CHIP8_SHM_DISPLAY_WORDS  (CHIP8_SHM_DISPLAY_WIDTH / 64)
+//.. Only XO-CHIP draws to the second one
+#define CHIP8_SHM_DISPLAY_PLANES 2
+
+struct Chip8ShmState {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    //.. Odd while the emulator is writing the fields below
+    uint32_t sequence;
+
+    uint64_t frame_count;
+
+    uint8_t data_registers[16];
+    uint16_t address_register;
+    uint16_t program_counter;
+    uint16_t stack[16];
+    uint8_t stack_length;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t reserved;
+
+    //.. Size of the display in its current resolution, 64x32 or 128x64
+    uint16_t display_width;
+    uint16_t display_height;
+    uint32_t reserved_display;
+
+    //.. Rows of packed pixels per bitplane, as the emulator keeps them: the
+    //   leftmost pixel of a row is the most-significant bit of its first
+    //   word. Only the top left display_width x display_height pixels are
+    //   used, see chip8_shm_pixel().
+    uint64_t display[CHIP8_SHM_DISPLAY_PLANES][CHIP8_SHM_DISPLAY_HEIGHT][CHIP8_SHM_DISPLAY_WORDS];
+};
+
+//.. Colour of a pixel in a copy made by chip8_shm_read(), bit n is set when
+//   it is lit in bitplane n
+static inline uint8_t
+chip8_shm_pixel(const struct Chip8ShmState* state, unsigned int row, unsigned int column)
+{
+    const unsigned int word = column / 64;
+    const unsigned int bit = 63 - column % 64;
+
+    return ((state->display[0][row][word] >> bit) & 1) |
+           (((state->display[1][row][word] >> bit) & 1) << 1);
+}
+
+//.. Copy a consistent snapshot of `shared` into `out`. Returns false if the
+//   segment has an unexpected layout.
+static inline bool
+chip8_shm_read(const struct Chip8ShmState* shared, struct Chip8ShmState* out)
+{
+    if (shared->magic != CHIP8_SHM_MAGIC ||
+        shared->version != CHIP8_SHM_VERSION ||
+        shared->size != sizeof(struct Chip8ShmState)
+    ) {
+        return false;
+    }
+
+    uint32_t sequence;
+    do {
+        while ((sequence = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        memcpy(out, shared, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) != sequence);
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,763 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "debugger.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static inline bool
+address_test(const uint64_t bitmap[ADDRESS_WORDS], uint16_t address)
+{
+    return (bitmap[address / 64] >> (address % 64)) & 1;
+}
+
+static inline void
+address_set(uint64_t bitmap[ADDRESS_WORDS], uint16_t address, bool value)
+{
+    if (value)
+        bitmap[address / 64] |= 1ULL << (address % 64);
+    else
+        bitmap[address / 64] &= ~(1ULL << (address % 64));
+}
+
+static unsigned int
+address_count(const uint64_t bitmap[ADDRESS_WORDS])
+{
+    unsigned int count = 0;
+    for (size_t i = 0; i < ADDRESS_WORDS; i++)
+        count += __builtin_popcountll(bitmap[i]);
+
+    return count;
+}
+
+static uint16_t
+opcode_at(const struct VM* vm, uint16_t address)
+{
+    if (address + 1 >= vm_memory_size(vm))
+        return 0;
+
+    return (vm->memory[address] << 8) | vm->memory[address + 1];
+}
+
+void
+debugger_init(struct Debugger* debugger)
+{
+    memset(debugger, 0, sizeof(*debugger));
+    debugger->stopped = true;
+}
+
+void
+debugger_disassemble(uint16_t opcode, char* buffer, size_t size)
+{
+    const unsigned int x = (opcode >> 8) & 0xF;
+    const unsigned int y = (opcode >> 4) & 0xF;
+    const unsigned int n = opcode & 0xF;
+    const unsigned int kk = opcode & 0xFF;
+    const unsigned int nnn = opcode & 0xFFF;
+
+    switch (opcode >> 12) {
+    case 0x0: {
+        static const char* SYSTEM_NAMES[256] = {
+            [0xE0] = "CLS", [0xEE] = "RET", [0xFB] = "SCR", [0xFC] = "SCL",
+            [0xFD] = "EXIT", [0xFE] = "LOW", [0xFF] = "HIGH",
+        };
+        if (x == 0 && SYSTEM_NAMES[kk] != NULL)
+            snprintf(buffer, size, "%s", SYSTEM_NAMES[kk]);
+        else if (x == 0 && y == 0xC)
+            snprintf(buffer, size, "SCD %u", n);
+        else if (x == 0 && y == 0xD)
+            snprintf(buffer, size, "SCU %u", n);
+        else
+            snprintf(buffer, size, "SYS 0x%03X", nnn);
+        return;
+    }
+    case 0x1:
+        snprintf(buffer, size, "JP 0x%03X", nnn);
+        return;
+    case 0x2:
+        snprintf(buffer, size, "CALL 0x%03X", nnn);
+        return;
+    case 0x3:
+        snprintf(buffer, size, "SE V%X, 0x%02X", x, kk);
+        return;
+    case 0x4:
+        snprintf(buffer, size, "SNE V%X, 0x%02X", x, kk);
+        return;
+    case 0x5:
+        if (n == 0)
+            snprintf(buffer, size, "SE V%X, V%X", x, y);
+        else if (n == 2)
+            snprintf(buffer, size, "SAVE V%X-V%X", x, y);
+        else if (n == 3)
+            snprintf(buffer, size, "LOAD V%X-V%X", x, y);
+        else
+            break;
+        return;
+    case 0x6:
+        snprintf(buffer, size, "LD V%X, 0x%02X", x, kk);
+        return;
+    case 0x7:
+        snprintf(buffer, size, "ADD V%X, 0x%02X", x, kk);
+        return;
+    case 0x8: {
+        static const char* ALU_NAMES[16] = {
+            [0x0] = "LD", [0x1] = "OR", [0x2] = "AND", [0x3] = "XOR",
+            [0x4] = "ADD", [0x5] = "SUB", [0x6] = "SHR", [0x7] = "SUBN",
+            [0xE] = "SHL",
+        };
+        if (ALU_NAMES[n] == NULL)
+            break;
+        snprintf(buffer, size, "%s V%X, V%X", ALU_NAMES[n], x, y);
+        return;
+    }
+    case 0x9:
+        if (n != 0)
+            break;
+        snprintf(buffer, size, "SNE V%X, V%X", x, y);
+        return;
+    case 0xA:
+        snprintf(buffer, size, "LD I, 0x%03X", nnn);
+        return;
+    case 0xB:
+        snprintf(buffer, size, "JP V0, 0x%03X", nnn);
+        return;
+    case 0xC:
+        snprintf(buffer, size, "RND V%X, 0x%02X", x, kk);
+        return;
+    case 0xD:
+        snprintf(buffer, size, "DRW V%X, V%X, %u", x, y, n);
+        return;
+    case 0xE:
+        if (kk == 0x9E) {
+            snprintf(buffer, size, "SKP V%X", x);
+            return;
+        }
+        if (kk == 0xA1) {
+            snprintf(buffer, size, "SKNP V%X", x);
+            return;
+        }
+        break;
+    case 0xF: {
+        if (opcode == 0xF000) {
+            snprintf(buffer, size, "LD I, long");
+            return;
+        }
+        if (opcode == 0xF002) {
+            snprintf(buffer, size, "AUDIO");
+            return;
+        }
+        if (kk == 0x01) {
+            snprintf(buffer, size, "PLANE %u", x);
+            return;
+        }
+
+        static const char* LOAD_FORMATS[256] = {
+            [0x07] = "LD V%X, DT", [0x0A] = "LD V%X, K", [0x15] = "LD DT, V%X",
+            [0x18] = "LD ST, V%X", [0x1E] = "ADD I, V%X", [0x29] = "LD F, V%X",
+            [0x33] = "LD B, V%X", [0x55] = "LD [I], V%X", [0x65] = "LD V%X, [I]",
+            [0x30] = "LD HF, V%X", [0x3A] = "PITCH V%X", [0x75] = "LD R, V%X",
+            [0x85] = "LD V%X, R",
+        };
+        if (LOAD_FORMATS[kk] == NULL)
+            break;
+        snprintf(buffer, size, LOAD_FORMATS[kk], x);
+        return;
+    }
+    }
+
+    snprintf(buffer, size, "DW 0x%04X", opcode);
+}
+
+//.. Memory the instruction at the program counter is about to access, if any
+static bool
+memory_access(const struct VM* vm, uint16_t* address, unsigned int* length, bool* write)
+{
+    const uint16_t opcode = opcode_at(vm, vm->program_counter);
+    const unsigned int x = (opcode >> 8) & 0xF;
+    const unsigned int y = (opcode >> 4) & 0xF;
+    const bool schip = vm->quirks == QUIRKS_SCHIP || vm->quirks == QUIRKS_XOCHIP;
+    const bool xochip = vm->quirks == QUIRKS_XOCHIP;
+
+    *address = vm->address_register;
+    if ((opcode & 0xF000) == 0xD000) {
+        //.. A 16x16 sprite for DXY0, one sprite per selected XO-CHIP plane
+        const unsigned int n = opcode & 0xF;
+        *length = (schip && n == 0 ? 32 : n) * (xochip ? __builtin_popcount(vm->planes) : 1);
+        *write = false;
+    } else if (xochip && (opcode & 0xF00E) == 0x5002) {
+        *length = (x <= y ? y - x : x - y) + 1;
+        *write = (opcode & 1) == 0;
+    } else if (xochip && opcode == 0xF002) {
+        *length = AUDIO_PATTERN_SIZE;
+        *write = false;
+    } else if ((opcode & 0xF0FF) == 0xF033) {
+        *length = 3;
+        *write = true;
+    } else if ((opcode & 0xF0FF) == 0xF055) {
+        *length = x + 1;
+        *write = true;
+    } else if ((opcode & 0xF0FF) == 0xF065) {
+        *length = x + 1;
+        *write = false;
+    } else {
+        return false;
+    }
+
+    return *length > 0;
+}
+
+static void
+print_location(const struct VM* vm, uint16_t address)
+{
+    char text[32];
+    const uint16_t opcode = opcode_at(vm, address);
+    debugger_disassemble(opcode, text, sizeof(text));
+
+    printf("%s 0x%03X: %04X  %s\n",
+           address == vm->program_counter ? "=>" : "  ", address, opcode, text);
+}
+
+static uint16_t
+operand_value(const struct VM* vm, uint8_t operand)
+{
+    switch (operand) {
+    case OPERAND_I:
+        return vm->address_register;
+    case OPERAND_DT:
+        return vm->delay_timer;
+    case OPERAND_ST:
+        return vm->sound_timer;
+    default:
+        return vm->data_registers[operand];
+    }
+}
+
+static const char* COMPARISON_NAMES[] = {
+    [COMPARE_EQUAL] = "==",
+    [COMPARE_NOT_EQUAL] = "!=",
+    [COMPARE_LESS] = "<",
+    [COMPARE_LESS_EQUAL] = "<=",
+    [COMPARE_GREATER] = ">",
+    [COMPARE_GREATER_EQUAL] = ">=",
+};
+#define COMPARISON_COUNT (sizeof(COMPARISON_NAMES) / sizeof(COMPARISON_NAMES[0]))
+
+static bool
+condition_holds(const struct VM* vm, const struct BreakCondition* condition)
+{
+    const uint16_t value = operand_value(vm, condition->operand);
+
+    switch (condition->comparison) {
+    case COMPARE_EQUAL:
+        return value == condition->value;
+    case COMPARE_NOT_EQUAL:
+        return value != condition->value;
+    case COMPARE_LESS:
+        return value < condition->value;
+    case COMPARE_LESS_EQUAL:
+        return value <= condition->value;
+    case COMPARE_GREATER:
+        return value > condition->value;
+    case COMPARE_GREATER_EQUAL:
+        return value >= condition->value;
+    default:
+        return false;
+    }
+}
+
+static void
+print_condition(const struct BreakCondition* condition)
+{
+    switch (condition->operand) {
+    case OPERAND_I:
+        printf("I");
+        break;
+    case OPERAND_DT:
+        printf("DT");
+        break;
+    case OPERAND_ST:
+        printf("ST");
+        break;
+    default:
+        printf("V%X", condition->operand);
+    }
+    printf(" %s 0x%X", COMPARISON_NAMES[condition->comparison], condition->value);
+}
+
+//.. Whether execution has to stop in front of the instruction at the program
+//   counter, printing why if so
+static bool
+should_stop(struct Debugger* debugger, const struct VM* vm)
+{
+    const uint16_t pc = vm->program_counter;
+
+    if (debugger->stepping_over && pc == debugger->step_over_return &&
+        vm->stack.length == debugger->step_over_depth
+    ) {
+        debugger->stepping_over = false;
+        return true;
+    }
+
+    if (address_test(debugger->breakpoints, pc)) {
+        if (address_test(debugger->unconditional, pc)) {
+            printf("Breakpoint at 0x%03X\n", pc);
+            return true;
+        }
+
+        for (unsigned int i = 0; i < debugger->condition_count; i++) {
+            const struct BreakCondition* condition = &debugger->conditions[i];
+            if (condition->address == pc && condition_holds(vm, condition)) {
+                printf("Breakpoint at 0x%03X if ", pc);
+                print_condition(condition);
+                putchar('\n');
+                return true;
+            }
+        }
+    }
+
+    uint16_t address;
+    unsigned int length;
+    bool write;
+    if (debugger->watchpoint_count > 0 && memory_access(vm, &address, &length, &write)) {
+        const uint64_t* watched = write ? debugger->watch_writes : debugger->watch_reads;
+        for (unsigned int i = 0; i < length && address + i < MEMORY_SIZE; i++) {
+            if (address_test(watched, address + i)) {
+                printf("Watchpoint: %s of 0x%03X\n", write ? "write" : "read", address + i);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+//.. Execute one instruction, ending the frame after the last one of it
+static enum Error
+execute_instruction(struct Debugger* debugger, struct VM* vm)
+{
+    enum Error err = vm_step(vm);
+    if (err != E_OK)
+        return err;
+
+    if (++debugger->frame_instructions == INSTRUCTIONS_PER_FRAME) {
+        debugger->frame_instructions = 0;
+        vm_end_frame(vm);
+    }
+
+    return E_OK;
+}
+
+//.. Run the rest of the current frame, or up to the next breakpoint or
+//   watchpoint, which leaves the debugger stopped
+enum Error
+debugger_run_frame(struct Debugger* debugger, struct VM* vm)
+{
+    const unsigned int remaining = INSTRUCTIONS_PER_FRAME - debugger->frame_instructions;
+
+    if (debugger->breakpoint_count == 0 && debugger->watchpoint_count == 0 &&
+        !debugger->stepping_over
+    ) {
+        enum Error err = vm_run_instructions(vm, remaining);
+        if (err != E_OK)
+            return err;
+
+        debugger->frame_instructions = 0;
+        debugger->resuming = false;
+        vm_end_frame(vm);
+        return E_OK;
+    }
+
+    for (unsigned int i = 0; i < remaining; i++) {
+        if (!debugger->resuming && should_stop(debugger, vm)) {
+            debugger->stopped = true;
+            print_location(vm, vm->program_counter);
+            return E_OK;
+        }
+        debugger->resuming = false;
+
+        enum Error err = execute_instruction(debugger, vm);
+        if (err != E_OK)
+            return err;
+    }
+
+    return E_OK;
+}
+
+static bool
+parse_number(const char* token, unsigned long limit, unsigned long* number)
+{
+    if (token == NULL)
+        return false;
+
+    char* end;
+    *number = strtoul(token, &end, 0);
+    return *end == '\0' && end != token && *number <= limit;
+}
+
+static bool
+parse_address(const char* token, uint16_t* address)
+{
+    unsigned long number;
+    if (!parse_number(token, MEMORY_SIZE - 1, &number))
+        return false;
+
+    *address = number;
+    return true;
+}
+
+static bool
+parse_operand(const char* token, uint8_t* operand)
+{
+    if (token == NULL)
+        return false;
+
+    if (strcasecmp(token, "I") == 0)
+        *operand = OPERAND_I;
+    else if (strcasecmp(token, "DT") == 0)
+        *operand = OPERAND_DT;
+    else if (strcasecmp(token, "ST") == 0)
+        *operand = OPERAND_ST;
+    else if ((token[0] == 'V' || token[0] == 'v') && token[1] != '\0' && token[2] == '\0') {
+        char* end;
+        *operand = strtoul(&token[1], &end, 16);
+        return *end == '\0';
+    } else
+        return false;
+
+    return true;
+}
+
+static bool
+parse_comparison(const char* token, uint8_t* comparison)
+{
+    for (size_t i = 0; token != NULL && i < COMPARISON_COUNT; i++) {
+        if (strcmp(token, COMPARISON_NAMES[i]) == 0) {
+            *comparison = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+recount(struct Debugger* debugger)
+{
+    debugger->breakpoint_count = address_count(debugger->breakpoints);
+
+    uint64_t watched[ADDRESS_WORDS];
+    for (size_t i = 0; i < ADDRESS_WORDS; i++)
+        watched[i] = debugger->watch_reads[i] | debugger->watch_writes[i];
+    debugger->watchpoint_count = address_count(watched);
+}
+
+static void
+command_break(struct Debugger* debugger)
+{
+    uint16_t address;
+    if (!parse_address(strtok(NULL, " \t\n"), &address)) {
+        puts("Usage: break <address> [if <V0-VF|I|DT|ST> <==|!=|<|<=|>|>=> <value>]");
+        return;
+    }
+
+    const char* keyword = strtok(NULL, " \t\n");
+    if (keyword == NULL) {
+        address_set(debugger->breakpoints, address, true);
+        address_set(debugger->unconditional, address, true);
+        printf("Breakpoint at 0x%03X\n", address);
+        return;
+    }
+
+    struct BreakCondition condition = {.address = address};
+    unsigned long value;
+    if (strcmp(keyword, "if") != 0 ||
+        !parse_operand(strtok(NULL, " \t\n"), &condition.operand) ||
+        !parse_comparison(strtok(NULL, " \t\n"), &condition.comparison) ||
+        !parse_number(strtok(NULL, " \t\n"), UINT16_MAX, &value)
+    ) {
+        puts("Usage: break <address> [if <V0-VF|I|DT|ST> <==|!=|<|<=|>|>=> <value>]");
+        return;
+    }
+    condition.value = value;
+
+    if (debugger->condition_count == DEBUGGER_MAX_CONDITIONS) {
+        printf("At most %d conditional breakpoints can be set\n", DEBUGGER_MAX_CONDITIONS);
+        return;
+    }
+
+    debugger->conditions[debugger->condition_count++] = condition;
+    address_set(debugger->breakpoints, address, true);
+    printf("Breakpoint at 0x%03X if ", address);
+    print_condition(&condition);
+    putchar('\n');
+}
+
+static void
+command_delete(struct Debugger* debugger)
+{
+    const char* token = strtok(NULL, " \t\n");
+    if (token == NULL) {
+        memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+        memset(debugger->unconditional, 0, sizeof(debugger->unconditional));
+        debugger->condition_count = 0;
+        puts("Deleted all breakpoints");
+        return;
+    }
+
+    uint16_t address;
+    if (!parse_address(token, &address)) {
+        puts("Usage: delete [address]");
+        return;
+    }
+
+    address_set(debugger->breakpoints, address, false);
+    address_set(debugger->unconditional, address, false);
+
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < debugger->condition_count; i++) {
+        if (debugger->conditions[i].address != address)
+            debugger->conditions[kept++] = debugger->conditions[i];
+    }
+    debugger->condition_count = kept;
+}
+
+static void
+command_watch(struct Debugger* debugger, bool reads, bool writes)
+{
+    uint16_t address;
+    unsigned long length = 1;
+    const char* length_token;
+    if (!parse_address(strtok(NULL, " \t\n"), &address) ||
+        ((length_token = strtok(NULL, " \t\n")) != NULL &&
+         !parse_number(length_token, MEMORY_SIZE - address, &length))
+    ) {
+        puts("Usage: watch|rwatch|awatch|unwatch <address> [length]");
+        return;
+    }
+
+    for (unsigned long i = 0; i < length; i++) {
+        address_set(debugger->watch_reads, address + i, reads);
+        address_set(debugger->watch_writes, address + i, writes);
+    }
+}
+
+static void
+print_breakpoints(const struct Debugger* debugger)
+{
+    for (uint32_t address = 0; address < MEMORY_SIZE; address++) {
+        if (!address_test(debugger->breakpoints, address))
+            continue;
+
+        if (address_test(debugger->unconditional, address))
+            printf("Breakpoint at 0x%03X\n", address);
+
+        for (unsigned int i = 0; i < debugger->condition_count; i++) {
+            if (debugger->conditions[i].address == address) {
+                printf("Breakpoint at 0x%03X if ", address);
+                print_condition(&debugger->conditions[i]);
+                putchar('\n');
+            }
+        }
+    }
+}
+
+static void
+print_watchpoints(const struct Debugger* debugger)
+{
+    //.. Print runs of addresses with the same kind of watchpoint as one range
+    unsigned int start = 0;
+    for (unsigned int address = 1; address <= MEMORY_SIZE; address++) {
+        const bool reads = address_test(debugger->watch_reads, start);
+        const bool writes = address_test(debugger->watch_writes, start);
+        if (address < MEMORY_SIZE &&
+            address_test(debugger->watch_reads, address) == reads &&
+            address_test(debugger->watch_writes, address) == writes
+        )
+            continue;
+
+        if (reads || writes) {
+            printf("Watchpoint on 0x%03X-0x%03X (%s)\n", start, address - 1,
+                   reads && writes ? "access" : reads ? "read" : "write");
+        }
+        start = address;
+    }
+}
+
+static void
+print_registers(const struct VM* vm)
+{
+    vm_print_debug(vm);
+    printf("DT = %d, ST = %d, frame %lu\n", vm->delay_timer, vm->sound_timer, vm->frame_count);
+
+    printf("Stack:");
+    for (uint8_t i = 0; i < vm->stack.length; i++)
+        printf(" 0x%03X", vm->stack.contents[i]);
+    putchar('\n');
+}
+
+static void
+print_memory(const struct VM* vm)
+{
+    uint16_t address;
+    unsigned long length = 16;
+    const char* length_token;
+    if (!parse_address(strtok(NULL, " \t\n"), &address) ||
+        address >= vm_memory_size(vm) ||
+        ((length_token = strtok(NULL, " \t\n")) != NULL &&
+         !parse_number(length_token, vm_memory_size(vm) - address, &length))
+    ) {
+        puts("Usage: x <address> [length]");
+        return;
+    }
+
+    for (unsigned long i = 0; i < length && address + i < (unsigned long) vm_memory_size(vm); i++) {
+        if (i % 16 == 0)
+            printf("%s0x%03lX:", i > 0 ? "\n" : "", address + i);
+        printf(" %02X", vm->memory[address + i]);
+    }
+    putchar('\n');
+}
+
+static void
+print_disassembly(const struct VM* vm)
+{
+    uint16_t address = vm->program_counter;
+    unsigned long count = 8;
+    const char* token = strtok(NULL, " \t\n");
+    if ((token != NULL && !parse_address(token, &address)) ||
+        ((token = strtok(NULL, " \t\n")) != NULL && !parse_number(token, MEMORY_SIZE, &count))
+    ) {
+        puts("Usage: disas [address] [count]");
+        return;
+    }
+
+    for (unsigned long i = 0; i < count && address + 1 < vm_memory_size(vm); i++, address += 2)
+        print_location(vm, address);
+}
+
+static void
+print_help(void)
+{
+    puts(
+        "c, continue                run until a breakpoint or watchpoint\n"
+        "s, step [count]            execute instructions\n"
+        "n, next                    execute an instruction, stepping over CALL\n"
+        "b, break <address> [if <V0-VF|I|DT|ST> <op> <value>]\n"
+        "                           stop at an address, if a comparison holds\n"
+        "d, delete [address]        delete the breakpoints at an address or all\n"
+        "watch <address> [length]   stop in front of writes to memory\n"
+        "rwatch <address> [length]  stop in front of reads of memory\n"
+        "awatch <address> [length]  stop in front of both\n"
+        "unwatch <address> [length] remove watchpoints\n"
+        "i, info [break|watch]      show registers, breakpoints or watchpoints\n"
+        "x <address> [length]       show memory\n"
+        "disas [address] [count]    disassemble, by default at the program counter\n"
+        "q, quit                    exit the emulator\n"
+        "An empty line repeats the previous command."
+    );
+}
+
+//.. Read commands while stopped, until one which lets the machine advance.
+//   Single steps are executed here and leave the debugger stopped, so the
+//   frontend gets to show the display in between.
+enum DebuggerAction
+debugger_prompt(struct Debugger* debugger, struct VM* vm, enum Error* err)
+{
+    char line[DEBUGGER_MAX_LINE];
+    *err = E_OK;
+
+    for (;;) {
+        printf("(chip8) ");
+        fflush(stdout);
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            putchar('\n');
+            return DEBUGGER_QUIT;
+        }
+
+        if (strspn(line, " \t\n") == strlen(line))
+            strcpy(line, debugger->last_line);
+        else
+            strcpy(debugger->last_line, line);
+
+        const char* command = strtok(line, " \t\n");
+        if (command == NULL)
+            continue;
+
+        if (strcmp(command, "c") == 0 || strcmp(command, "continue") == 0) {
+            debugger->stepping_over = false;
+            debugger->stopped = false;
+            debugger->resuming = true;
+            return DEBUGGER_RESUME;
+        }
+
+        if (strcmp(command, "n") == 0 || strcmp(command, "next") == 0) {
+            if ((opcode_at(vm, vm->program_counter) & 0xF000) == 0x2000) {
+                debugger->stepping_over = true;
+                debugger->step_over_return = vm->program_counter + 2;
+                debugger->step_over_depth = vm->stack.length;
+                debugger->stopped = false;
+                debugger->resuming = true;
+                return DEBUGGER_RESUME;
+            }
+
+            if ((*err = execute_instruction(debugger, vm)) == E_OK)
+                print_location(vm, vm->program_counter);
+            return DEBUGGER_RESUME;
+        }
+
+        if (strcmp(command, "s") == 0 || strcmp(command, "step") == 0) {
+            unsigned long count = 1;
+            const char* token = strtok(NULL, " \t\n");
+            if (token != NULL && !parse_number(token, ULONG_MAX, &count)) {
+                puts("Usage: step [count]");
+                continue;
+            }
+
+            for (unsigned long i = 0; i < count; i++) {
+                if (i > 0 && should_stop(debugger, vm))
+                    break;
+                if ((*err = execute_instruction(debugger, vm)) != E_OK)
+                    return DEBUGGER_RESUME;
+            }
+            print_location(vm, vm->program_counter);
+            return DEBUGGER_RESUME;
+        }
+
+        if (strcmp(command, "q") == 0 || strcmp(command, "quit") == 0)
+            return DEBUGGER_QUIT;
+
+        if (strcmp(command, "b") == 0 || strcmp(command, "break") == 0)
+            command_break(debugger);
+        else if (strcmp(command, "d") == 0 || strcmp(command, "delete") == 0)
+            command_delete(debugger);
+        else if (strcmp(command, "watch") == 0)
+            command_watch(debugger, false, true);
+        else if (strcmp(command, "rwatch") == 0)
+            command_watch(debugger, true, false);
+        else if (strcmp(command, "awatch") == 0)
+            command_watch(debugger, true, true);
+        else if (strcmp(command, "unwatch") == 0)
+            command_watch(debugger, false, false);
+        else if (strcmp(command, "i") == 0 || strcmp(command, "info") == 0) {
+            const char* what = strtok(NULL, " \t\n");
+            if (what != NULL && strncmp(what, "break", 5) == 0)
+                print_breakpoints(debugger);
+            else if (what != NULL && strncmp(what, "watch", 5) == 0)
+                print_watchpoints(debugger);
+            else
+                print_registers(vm);
+        } else if (strcmp(command, "x") == 0)
+            print_memory(vm);
+        else if (strcmp(command, "disas") == 0)
+            print_disassembly(vm);
+        else if (strcmp(command, "h") == 0 || strcmp(command, "help") == 0)
+            print_help();
+        else
+            printf("Unknown command '%s', try help\n", command);
+
+        recount(debugger);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef DEBUGGER_H_
+#define DEBUGGER_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interactive debugger with a GDB-like command line on stdin. The machine
+ * starts stopped, debugger_prompt() reads commands until one resumes it.
+ *
+ * Breakpoints and watchpoints are kept in per-address bitmaps. With none set
+ * and no step in progress, debugger_run_frame() hands the rest of the frame
+ * to vm_run_instructions() in one go, so the interpreter loop is untouched.
+ * Otherwise instructions are single-stepped and every program counter is
+ * looked up in the bitmap.
+ *
+ * Watchpoints are checked before an instruction executes: the memory it will
+ * read or write only depends on the opcode and I, see memory_access() in
+ * debugger.c. Instruction fetches do not count as reads.
+ */
+
+#define ADDRESS_WORDS            ((MEMORY_SIZE + 63) / 64)
+#define DEBUGGER_MAX_CONDITIONS  32
+#define DEBUGGER_MAX_LINE        256
+
+//.. Operands of conditional breakpoints besides V0-VF
+enum DebuggerOperand {
+    OPERAND_I = REGISTERS_SIZE,
+    OPERAND_DT,
+    OPERAND_ST,
+};
+
+enum DebuggerComparison {
+    COMPARE_EQUAL,
+    COMPARE_NOT_EQUAL,
+    COMPARE_LESS,
+    COMPARE_LESS_EQUAL,
+    COMPARE_GREATER,
+    COMPARE_GREATER_EQUAL,
+};
+
+//.. Breakpoint which only stops when a comparison holds
+struct BreakCondition {
+    uint16_t address;
+    uint8_t operand;    /* V0-VF or enum DebuggerOperand */
+    uint8_t comparison; /* enum DebuggerComparison */
+    uint16_t value;
+};
+
+struct Debugger {
+    //.. Addresses with any breakpoint, and those stopping unconditionally
+    uint64_t breakpoints[ADDRESS_WORDS];
+    uint64_t unconditional[ADDRESS_WORDS];
+    struct BreakCondition conditions[DEBUGGER_MAX_CONDITIONS];
+    unsigned int condition_count;
+    unsigned int breakpoint_count;
+
+    uint64_t watch_reads[ADDRESS_WORDS];
+    uint64_t watch_writes[ADDRESS_WORDS];
+    unsigned int watchpoint_count;
+
+    //.. Step over a CALL: stop once the stack is back at this depth
+    bool stepping_over;
+    uint16_t step_over_return;
+    uint8_t step_over_depth;
+
+    //.. Instructions of the current frame executed so far
+    unsigned int frame_instructions;
+    bool stopped;
+    //.. Execute the next instruction without checking for stops, set when
+    //   continuing from a breakpoint or watchpoint
+    bool resuming;
+    //.. An empty line repeats the previous command
+    char last_line[DEBUGGER_MAX_LINE];
+};
+
+enum DebuggerAction {
+    DEBUGGER_RESUME,
+    DEBUGGER_QUIT,
+};
+
+void                debugger_init(struct Debugger*);
+enum Error          debugger_run_frame(struct Debugger*, struct VM*);
+enum DebuggerAction debugger_prompt(struct Debugger*, struct VM*, enum Error*);
+void                debugger_disassemble(uint16_t opcode, char* buffer, size_t size);
+
+#endif
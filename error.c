@@ -18,8 +18,32 @@ error_to_str(enum Error err)
         return "couldn't open file";
     case E_COULDNT_READ_FILE:
         return "couldn't read file";
+    case E_COULDNT_WRITE_FILE:
+        return "couldn't write file";
     case E_SDL_ERROR:
         return SDL_GetError();
+    case E_SOCKET_ERROR:
+        return "couldn't set up control socket";
+    case E_SHM_ERROR:
+        return "couldn't set up shared memory export";
+    case E_SHM_EXISTS:
+        return "shared memory segment already exists, -M replaces it";
+    case E_OUT_OF_MEMORY:
+        return "couldn't allocate memory";
+    case E_BATCH_MAPPING_ERROR:
+        return "couldn't map shared batch memory, vm.max_map_count may be too low";
+    case E_INVALID_QUIRK_DATABASE:
+        return "malformed line in quirk database";
+    case E_INVALID_MANIFEST:
+        return "invalid entry in regression manifest";
+    case E_INVALID_MOVIE:
+        return "invalid movie file";
+    case E_MOVIE_ROM_MISMATCH:
+        return "movie was recorded with a different ROM";
+    case E_MOVIE_PROFILE_MISMATCH:
+        return "movie was recorded with a different quirk profile";
+    case E_MOVIE_DESYNC:
+        return "movie playback desynchronised";
     case E_OK:
         return "OK is not an error.";
     }
@@ -11,7 +11,19 @@ enum Error {
     E_VM_UNKNOWN_UPCODE,
     E_COULDNT_OPEN_FILE,
     E_COULDNT_READ_FILE,
+    E_COULDNT_WRITE_FILE,
     E_SDL_ERROR,
+    E_SOCKET_ERROR,
+    E_SHM_ERROR,
+    E_SHM_EXISTS,
+    E_OUT_OF_MEMORY,
+    E_BATCH_MAPPING_ERROR,
+    E_INVALID_QUIRK_DATABASE,
+    E_INVALID_MANIFEST,
+    E_INVALID_MOVIE,
+    E_MOVIE_ROM_MISMATCH,
+    E_MOVIE_PROFILE_MISMATCH,
+    E_MOVIE_DESYNC,
 };
 
 const char* error_to_str(enum Error err);
@@ -0,0 +1,272 @@
+#include "filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char* const SCALER_NAMES[] = {
+    [SCALER_NONE] = "none",
+    [SCALER_SCALE2X] = "scale2x",
+};
+
+bool
+filter_scaler_from_name(const char* name, enum Scaler* scaler)
+{
+    for (size_t i = 0; i < sizeof(SCALER_NAMES) / sizeof(SCALER_NAMES[0]); i++) {
+        if (strcmp(name, SCALER_NAMES[i]) == 0) {
+            *scaler = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+enum Error
+filter_init(struct Filter* filter, unsigned int width, unsigned int height,
+            enum Scaler scaler, unsigned int persistence_percent)
+{
+    if (persistence_percent > 100)
+        persistence_percent = 100;
+
+    *filter = (struct Filter) {
+        .scaler = scaler,
+        .decay = persistence_percent * 256 / 100,
+        .width = width,
+        .height = height,
+    };
+
+    const size_t size = (size_t) width * height * sizeof(uint32_t);
+    filter->buffers[0] = malloc(size);
+    filter->buffers[1] = malloc(size);
+    if (filter->buffers[0] == NULL || filter->buffers[1] == NULL)
+        goto error;
+
+    if (filter->decay > 0) {
+        filter->phosphor = malloc(DISPLAY_MAX_WIDTH * DISPLAY_MAX_HEIGHT * sizeof(uint32_t));
+        if (filter->phosphor == NULL)
+            goto error;
+    }
+
+    return E_OK;
+
+    error:
+        filter_free(filter);
+        return E_OUT_OF_MEMORY;
+}
+
+//.. One ARGB pixel per CHIP-8 pixel, rows are `vm_display_width()` apart
+static void
+expand_display(const struct VM* vm, const uint32_t palette[], uint32_t* out)
+{
+    const unsigned int width = vm_display_width(vm);
+    const unsigned int height = vm_display_height(vm);
+
+    for (unsigned int row = 0; row < height; row++) {
+        for (unsigned int col = 0; col < width; col++)
+            *out++ = palette[vm_pixel(vm, row, col)];
+    }
+}
+
+//.. Scale2x of pixel `x` of the row `mid`, into two pixels of both output rows.
+//   Pixels outside of the image are taken to be the same as `mid[x]`.
+static inline void
+scale2x_pixel(const uint32_t* up, const uint32_t* mid, const uint32_t* down,
+              unsigned int x, unsigned int width, uint32_t* out0, uint32_t* out1)
+{
+    const uint32_t p = mid[x];
+    const uint32_t a = up[x];
+    const uint32_t b = x + 1 < width ? mid[x + 1] : p;
+    const uint32_t c = x > 0 ? mid[x - 1] : p;
+    const uint32_t d = down[x];
+
+    out0[2 * x]     = c == a && c != d && a != b ? a : p;
+    out0[2 * x + 1] = a == b && a != c && b != d ? b : p;
+    out1[2 * x]     = d == c && d != b && c != a ? c : p;
+    out1[2 * x + 1] = b == d && b != a && d != c ? d : p;
+}
+
+#ifdef __SSE2__
+static inline __m128i
+select_epi32(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+//.. scale2x_pixel() for four pixels starting at `x`, which must have a
+//   neighbour on both sides
+static inline void
+scale2x_vector(const uint32_t* up, const uint32_t* mid, const uint32_t* down,
+               unsigned int x, uint32_t* out0, uint32_t* out1)
+{
+    const __m128i p = _mm_loadu_si128((const __m128i*) (mid + x));
+    const __m128i a = _mm_loadu_si128((const __m128i*) (up + x));
+    const __m128i b = _mm_loadu_si128((const __m128i*) (mid + x + 1));
+    const __m128i c = _mm_loadu_si128((const __m128i*) (mid + x - 1));
+    const __m128i d = _mm_loadu_si128((const __m128i*) (down + x));
+
+    const __m128i ca = _mm_cmpeq_epi32(c, a);
+    const __m128i cd = _mm_cmpeq_epi32(c, d);
+    const __m128i ab = _mm_cmpeq_epi32(a, b);
+    const __m128i bd = _mm_cmpeq_epi32(b, d);
+
+    //.. andnot(x, y) is ~x & y
+    const __m128i e0 = select_epi32(_mm_andnot_si128(_mm_or_si128(cd, ab), ca), a, p);
+    const __m128i e1 = select_epi32(_mm_andnot_si128(_mm_or_si128(ca, bd), ab), b, p);
+    const __m128i e2 = select_epi32(_mm_andnot_si128(_mm_or_si128(bd, ca), cd), c, p);
+    const __m128i e3 = select_epi32(_mm_andnot_si128(_mm_or_si128(ab, cd), bd), d, p);
+
+    _mm_storeu_si128((__m128i*) (out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+    _mm_storeu_si128((__m128i*) (out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+    _mm_storeu_si128((__m128i*) (out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+    _mm_storeu_si128((__m128i*) (out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+}
+#endif
+
+//.. Scale2x (EPX) of a `width` x `height` image to twice its size
+static void
+scale2x(const uint32_t* in, unsigned int width, unsigned int height,
+        uint32_t* out, size_t out_stride)
+{
+    for (unsigned int y = 0; y < height; y++) {
+        const uint32_t* mid = in + (size_t) y * width;
+        const uint32_t* up = y > 0 ? mid - width : mid;
+        const uint32_t* down = y + 1 < height ? mid + width : mid;
+        uint32_t* out0 = out + 2 * y * out_stride;
+        uint32_t* out1 = out0 + out_stride;
+
+        unsigned int x = 0;
+#ifdef __SSE2__
+        //.. The first and last pixel lack a neighbour, they're done below
+        scale2x_pixel(up, mid, down, x++, width, out0, out1);
+        for (; x + 4 < width; x += 4)
+            scale2x_vector(up, mid, down, x, out0, out1);
+#endif
+        for (; x < width; x++)
+            scale2x_pixel(up, mid, down, x, width, out0, out1);
+    }
+}
+
+//.. Upscale by repeating every pixel `factor` times in both directions
+static void
+repeat_pixels(const uint32_t* in, unsigned int width, unsigned int height,
+              unsigned int factor, uint32_t* out, size_t out_stride)
+{
+    for (unsigned int y = 0; y < height; y++) {
+        uint32_t* row = out + (size_t) y * factor * out_stride;
+        for (unsigned int x = 0; x < width; x++) {
+            const uint32_t pixel = in[(size_t) y * width + x];
+            for (unsigned int i = 0; i < factor; i++)
+                row[x * factor + i] = pixel;
+        }
+
+        for (unsigned int i = 1; i < factor; i++)
+            memcpy(row + i * out_stride, row, (size_t) width * factor * sizeof(uint32_t));
+    }
+}
+
+//.. Brighter of every channel of `pixel` and `old` faded by `decay`/256
+static inline uint32_t
+fade(uint32_t old, uint32_t pixel, uint16_t decay)
+{
+    uint32_t result = 0;
+    for (unsigned int shift = 0; shift < 32; shift += 8) {
+        const uint32_t faded = ((old >> shift) & 0xFF) * decay >> 8;
+        const uint32_t channel = (pixel >> shift) & 0xFF;
+        result |= (channel > faded ? channel : faded) << shift;
+    }
+
+    return result;
+}
+
+//.. Blend `frame` into the phosphor image, and replace it with the result
+static void
+blend_phosphor(uint32_t* frame, uint32_t* phosphor, size_t count, uint16_t decay)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i factor = _mm_set1_epi16(decay);
+    for (; i + 4 <= count; i += 4) {
+        const __m128i previous = _mm_loadu_si128((const __m128i*) (phosphor + i));
+        const __m128i low = _mm_srli_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(previous, zero), factor), 8);
+        const __m128i high = _mm_srli_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(previous, zero), factor), 8);
+        const __m128i result = _mm_max_epu8(
+            _mm_packus_epi16(low, high), _mm_loadu_si128((const __m128i*) (frame + i)));
+
+        _mm_storeu_si128((__m128i*) (phosphor + i), result);
+        _mm_storeu_si128((__m128i*) (frame + i), result);
+    }
+#endif
+    for (; i < count; i++)
+        frame[i] = phosphor[i] = fade(phosphor[i], frame[i], decay);
+}
+
+//.. Render the display of `vm` with the colours of `palette`, indexed by
+//   vm_pixel(), into `out`, whose rows are `out_stride` pixels apart. The
+//   filter's size must be a multiple of the display's.
+void
+filter_run(struct Filter* filter, const struct VM* vm, const uint32_t palette[],
+           uint32_t* out, size_t out_stride)
+{
+    unsigned int width = vm_display_width(vm);
+    unsigned int height = vm_display_height(vm);
+    unsigned int factor = filter->width / width;
+    assert(factor * width == filter->width && factor * height == filter->height);
+
+    unsigned int passes = 0;
+    if (filter->scaler == SCALER_SCALE2X) {
+        for (; factor % 2 == 0; factor /= 2)
+            passes++;
+    }
+    //.. Pixel repetition for the rest, which is also what copies the frame
+    //   over when there's nothing to scale
+    const bool repeat = factor > 1 || passes == 0;
+
+    uint32_t* in = filter->buffers[0];
+    expand_display(vm, palette, in);
+
+    //.. Blended before upscaling, at a fraction of the cost. The phosphor
+    //   starts over from the current frame when the resolution changes.
+    if (filter->phosphor != NULL) {
+        if (width != filter->phosphor_width) {
+            memcpy(filter->phosphor, in, (size_t) width * height * sizeof(uint32_t));
+            filter->phosphor_width = width;
+        }
+        blend_phosphor(in, filter->phosphor, (size_t) width * height, filter->decay);
+    }
+
+    //.. The stages ping-pong between the two buffers, the last one writes
+    //   to `out`
+    for (unsigned int stage = 0; stage < passes + repeat; stage++) {
+        const bool last = stage + 1 == passes + repeat;
+        uint32_t* stage_out = last ? out : (in == filter->buffers[0]
+            ? filter->buffers[1]
+            : filter->buffers[0]);
+        const unsigned int stage_factor = stage < passes ? 2 : factor;
+        const size_t stride = last ? out_stride : width * stage_factor;
+
+        if (stage < passes)
+            scale2x(in, width, height, stage_out, stride);
+        else
+            repeat_pixels(in, width, height, factor, stage_out, stride);
+
+        in = stage_out;
+        width *= stage_factor;
+        height *= stage_factor;
+    }
+}
+
+void
+filter_free(struct Filter* filter)
+{
+    free(filter->buffers[0]);
+    free(filter->buffers[1]);
+    free(filter->phosphor);
+    filter->buffers[0] = filter->buffers[1] = filter->phosphor = NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Software post-processing of the display, from the packed bitplanes of a VM
+ * to an ARGB frame of the window's size:
+ *
+ *   1. The display is expanded to one ARGB pixel per CHIP-8 pixel.
+ *   2. With a persistence above 0, it is blended with the previous frames
+ *      like a slow phosphor: every channel keeps the brighter of its new
+ *      value and its old value faded by the persistence. Sprites which are
+ *      erased and redrawn by XOR then dim instead of flickering.
+ *   3. It is upscaled: with SCALER_SCALE2X by repeated Scale2x (EPX) passes
+ *      for the power-of-two part of the scale factor, which rounds off
+ *      diagonal edges, and by pixel repetition for whatever is left.
+ *
+ * The Scale2x and blend kernels use SSE2 when the compiler targets it and
+ * plain C otherwise.
+ */
+
+enum Scaler {
+    SCALER_NONE,    /* Blocks of pixels */
+    SCALER_SCALE2X,
+};
+
+struct Filter {
+    enum Scaler scaler;
+    //.. Fraction of the previous output kept per frame, in 1/256ths
+    uint16_t decay;
+    unsigned int width;
+    unsigned int height;
+
+    //.. Intermediate images of the upscaling, both of the output's size
+    uint32_t* buffers[2];
+    //.. Blended display, NULL without persistence
+    uint32_t* phosphor;
+    unsigned int phosphor_width;
+};
+
+bool       filter_scaler_from_name(const char* name, enum Scaler*);
+enum Error filter_init(struct Filter*, unsigned int width, unsigned int height,
+                       enum Scaler, unsigned int persistence_percent);
+void       filter_run(struct Filter*, const struct VM*, const uint32_t palette[],
+                      uint32_t* out, size_t out_stride);
+void       filter_free(struct Filter*);
+
+#endif
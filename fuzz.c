@@ -0,0 +1,57 @@
+/* libFuzzer entry point for the headless core, built with `make fuzz`.
+ *
+ * An input is a quirk profile byte, the keypad state as two bytes and the ROM
+ * image. Every input starts from the power-on snapshot of its profile, which
+ * is restored by copying back only the memory the previous input of that
+ * profile dirtied.
+ */
+
+#ifdef CHIP8_FUZZER
+
+#include "vm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define FUZZ_FRAMES 60
+#define FUZZ_SEED   0x2545F491
+
+int LLVMFuzzerTestOneInput(const uint8_t*, size_t);
+
+#define PROFILES (QUIRKS_XOCHIP + 1)
+
+static struct VM* snapshots[PROFILES];
+static struct VM* vms[PROFILES];
+
+int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size < 3)
+        return 0;
+
+    const enum QuirkProfile profile = data[0] % PROFILES;
+    struct VM* vm = vms[profile];
+    if (vm == NULL) {
+        if (vm_alloc(&vm, profile) != E_OK || vm_alloc(&snapshots[profile], profile) != E_OK)
+            abort();
+        vm->random_state = FUZZ_SEED;
+        vm_snapshot(vm, snapshots[profile]);
+        vms[profile] = vm;
+    }
+
+    vm_restore(vm, snapshots[profile]);
+    vm->keypad = data[1] | (data[2] << 8);
+    if (vm_load_rom(vm, data + 3, size - 3) != E_OK)
+        return 0;
+
+    //.. Machine errors end the run, only crashes and sanitizer reports count
+    for (unsigned int frame = 0; frame < FUZZ_FRAMES; frame++) {
+        if (vm_run_frame(vm) != E_OK)
+            break;
+    }
+
+    return 0;
+}
+
+#endif
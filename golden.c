@@ -0,0 +1,481 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "golden.h"
+#include "hash.h"
+#include "png.h"
+#include "quirks.h"
+#include "vm.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PATH 1024
+#define MAX_KEY  4096
+
+struct GoldenInput {
+    unsigned long frame;
+    uint16_t keypad;
+};
+
+struct GoldenEntry {
+    unsigned int line;
+    //.. What the golden values are filed under: the ROM as written in the
+    //   manifest, the profile and the inputs, see read_golden()
+    char key[MAX_KEY];
+    char rom_path[MAX_PATH];
+    unsigned long frames;
+    enum QuirkProfile quirks;
+    struct GoldenInput inputs[GOLDEN_MAX_INPUTS];
+    size_t input_count;
+
+    size_t checkpoint_count;
+    uint64_t* expected; /* NULL when there are no golden values */
+    bool* known;        /* Which checkpoints have a golden value */
+    uint64_t* hashes;
+
+    //.. Results
+    enum Error err;
+    unsigned long error_frame;
+    bool mismatch;
+    size_t mismatch_checkpoint;
+    bool missing;
+    size_t missing_checkpoint;
+    enum Error png_err;
+};
+
+struct GoldenRun {
+    struct GoldenEntry* entries;
+    size_t entry_count;
+    size_t next_entry;
+    const char* manifest_path;
+    bool regenerate;
+};
+
+static unsigned long
+checkpoint_frame(const struct GoldenEntry* entry, size_t checkpoint)
+{
+    const unsigned long frame = (checkpoint + 1) * GOLDEN_CHECKPOINT_INTERVAL;
+    return frame < entry->frames ? frame : entry->frames;
+}
+
+//.. Hash of what a ROM's behaviour is judged by: the display and registers.
+//   Independent of the incremental state hash, so that a bug in the hash
+//   bookkeeping can't hide a behaviour change.
+static uint64_t
+checkpoint_hash(const struct VM* vm)
+{
+    uint8_t registers[REGISTERS_SIZE + 8];
+    memcpy(registers, vm->data_registers, REGISTERS_SIZE);
+    registers[REGISTERS_SIZE + 0] = vm->address_register >> 8;
+    registers[REGISTERS_SIZE + 1] = vm->address_register & 0xFF;
+    registers[REGISTERS_SIZE + 2] = vm->program_counter >> 8;
+    registers[REGISTERS_SIZE + 3] = vm->program_counter & 0xFF;
+    registers[REGISTERS_SIZE + 4] = vm->stack.length;
+    registers[REGISTERS_SIZE + 5] = vm->delay_timer;
+    registers[REGISTERS_SIZE + 6] = vm->sound_timer;
+    registers[REGISTERS_SIZE + 7] = vm->hires;
+
+    return hash_bytes((const uint8_t*) vm->display, sizeof(vm->display)) ^
+           hash_bytes(registers, sizeof(registers)) * 31;
+}
+
+//.. Run a powered-on VM with the entry's ROM loaded and check its checkpoints
+static void
+run_frames(const struct GoldenRun* run, struct GoldenEntry* entry, struct VM* vm)
+{
+    size_t input = 0;
+    size_t checkpoint = 0;
+    for (unsigned long frame = 0; frame < entry->frames; frame++) {
+        while (input < entry->input_count && entry->inputs[input].frame <= frame)
+            vm->keypad = entry->inputs[input++].keypad;
+
+        if ((entry->err = vm_run_frame(vm)) != E_OK) {
+            entry->error_frame = frame;
+            return;
+        }
+
+        if (frame + 1 != checkpoint_frame(entry, checkpoint))
+            continue;
+
+        const uint64_t hash = checkpoint_hash(vm);
+        entry->hashes[checkpoint] = hash;
+
+        if (run->regenerate || entry->expected == NULL) {
+            checkpoint++;
+            continue;
+        }
+
+        if (!entry->known[checkpoint]) {
+            if (!entry->missing) {
+                entry->missing = true;
+                entry->missing_checkpoint = checkpoint;
+            }
+        } else if (entry->expected[checkpoint] != hash) {
+            entry->mismatch = true;
+            entry->mismatch_checkpoint = checkpoint;
+
+            char png_path[MAX_PATH + 64];
+            snprintf(png_path, sizeof(png_path), "%s.%u.%lu.png",
+                     run->manifest_path, entry->line, frame + 1);
+            entry->png_err = png_write_display(png_path, vm, 8);
+            return;
+        }
+
+        checkpoint++;
+    }
+}
+
+static void
+run_entry(const struct GoldenRun* run, struct GoldenEntry* entry)
+{
+    struct VM* vm;
+    if ((entry->err = vm_alloc(&vm, entry->quirks)) != E_OK)
+        return;
+    vm->random_state = GOLDEN_RANDOM_SEED;
+
+    if ((entry->err = vm_insert_rom(vm, entry->rom_path)) == E_OK)
+        run_frames(run, entry, vm);
+
+    free(vm);
+}
+
+static void*
+worker(void* argument)
+{
+    struct GoldenRun* run = argument;
+
+    for (;;) {
+        const size_t index = __atomic_fetch_add(&run->next_entry, 1, __ATOMIC_RELAXED);
+        if (index >= run->entry_count)
+            return NULL;
+
+        run_entry(run, &run->entries[index]);
+    }
+}
+
+//.. Resolve `path` relative to the directory of the manifest
+static void
+resolve_path(char* out, const char* manifest_path, const char* path)
+{
+    const char* slash = strrchr(manifest_path, '/');
+    if (path[0] == '/' || slash == NULL) {
+        snprintf(out, MAX_PATH, "%s", path);
+        return;
+    }
+
+    snprintf(out, MAX_PATH, "%.*s/%s", (int) (slash - manifest_path), manifest_path, path);
+}
+
+static enum Error
+parse_entry(const char* manifest_path, char* line, struct GoldenEntry* entry)
+{
+    char* saveptr;
+    const char* rom = strtok_r(line, " \t\n", &saveptr);
+    const char* frames = strtok_r(NULL, " \t\n", &saveptr);
+    const char* profile = strtok_r(NULL, " \t\n", &saveptr);
+    if (rom == NULL || frames == NULL || profile == NULL)
+        return E_INVALID_MANIFEST;
+
+    resolve_path(entry->rom_path, manifest_path, rom);
+    entry->frames = strtoul(frames, NULL, 10);
+    if (entry->frames == 0 || !quirks_from_name(profile, &entry->quirks))
+        return E_INVALID_MANIFEST;
+
+    const char* token;
+    char inputs[MAX_KEY] = "";
+    size_t inputs_length = 0;
+    while ((token = strtok_r(NULL, " \t\n", &saveptr)) != NULL) {
+        struct GoldenInput* input = &entry->inputs[entry->input_count];
+        unsigned int keypad;
+        if (entry->input_count == GOLDEN_MAX_INPUTS ||
+            sscanf(token, "%lu:%x", &input->frame, &keypad) != 2
+        ) {
+            return E_INVALID_MANIFEST;
+        }
+        input->keypad = keypad;
+        entry->input_count++;
+
+        inputs_length += snprintf(inputs + inputs_length, sizeof(inputs) - inputs_length,
+                                  "%s%lu:%04x", inputs_length > 0 ? "," : "",
+                                  input->frame, keypad);
+        if (inputs_length >= sizeof(inputs))
+            return E_INVALID_MANIFEST;
+    }
+
+    if (snprintf(entry->key, sizeof(entry->key), "%s %s %s", rom, quirks_name(entry->quirks),
+                 inputs_length > 0 ? inputs : "-") >= (int) sizeof(entry->key))
+        return E_INVALID_MANIFEST;
+
+    entry->checkpoint_count =
+        (entry->frames + GOLDEN_CHECKPOINT_INTERVAL - 1) / GOLDEN_CHECKPOINT_INTERVAL;
+    entry->hashes = calloc(entry->checkpoint_count, sizeof(uint64_t));
+    if (entry->hashes == NULL)
+        return E_OUT_OF_MEMORY;
+
+    return E_OK;
+}
+
+static enum Error
+read_manifest(struct GoldenRun* run)
+{
+    FILE* file = fopen(run->manifest_path, "r");
+    if (file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    enum Error err = E_OK;
+    char line[4096];
+    unsigned int line_number = 0;
+    size_t capacity = 0;
+
+    while (err == E_OK && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        if (line[strspn(line, " \t\n")] == '\0' || line[0] == '#')
+            continue;
+
+        if (run->entry_count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            struct GoldenEntry* entries = realloc(run->entries, capacity * sizeof(*entries));
+            if (entries == NULL) {
+                err = E_OUT_OF_MEMORY;
+                break;
+            }
+            run->entries = entries;
+        }
+
+        struct GoldenEntry* entry = &run->entries[run->entry_count++];
+        *entry = (struct GoldenEntry) { .line = line_number, .err = E_OK, .png_err = E_OK };
+        err = parse_entry(run->manifest_path, line, entry);
+        if (err == E_INVALID_MANIFEST)
+            fprintf(stderr, "%s:%u: invalid entry\n", run->manifest_path, line_number);
+    }
+
+    fclose(file);
+    return err;
+}
+
+//.. Index of the checkpoint at `frame`, or -1 when the entry has none there
+static long
+checkpoint_at(const struct GoldenEntry* entry, unsigned long frame)
+{
+    if (frame == 0 || frame > entry->frames)
+        return -1;
+
+    const size_t checkpoint = (frame - 1) / GOLDEN_CHECKPOINT_INTERVAL;
+    return checkpoint_frame(entry, checkpoint) == frame ? (long) checkpoint : -1;
+}
+
+//.. The golden file has a `<rom> <profile> <inputs> <frame> <hash>` line per
+//   checkpoint. The ROM is as written in the manifest and the inputs are
+//   joined by commas, or `-` for none; editing other lines of the manifest
+//   leaves the values of an entry alone. Entries that only differ in their
+//   frame count share their values.
+static enum Error
+read_golden(struct GoldenRun* run, const char* golden_path)
+{
+    FILE* file = fopen(golden_path, "r");
+    if (file == NULL)
+        return E_OK; /* Nothing to compare with yet */
+
+    char rom[MAX_PATH], profile[64], inputs[MAX_KEY], key[MAX_KEY + MAX_PATH + 64];
+    unsigned long frame;
+    uint64_t hash;
+    while (fscanf(file, "%1023s %63s %4095s %lu %" SCNx64,
+                  rom, profile, inputs, &frame, &hash) == 5
+    ) {
+        snprintf(key, sizeof(key), "%s %s %s", rom, profile, inputs);
+
+        for (size_t i = 0; i < run->entry_count; i++) {
+            struct GoldenEntry* entry = &run->entries[i];
+            const long checkpoint = checkpoint_at(entry, frame);
+            if (checkpoint < 0 || strcmp(entry->key, key) != 0)
+                continue;
+
+            if (entry->expected == NULL) {
+                entry->expected = calloc(entry->checkpoint_count, sizeof(uint64_t));
+                entry->known = calloc(entry->checkpoint_count, sizeof(bool));
+                if (entry->expected == NULL || entry->known == NULL) {
+                    fclose(file);
+                    return E_OUT_OF_MEMORY;
+                }
+            }
+            entry->expected[checkpoint] = hash;
+            entry->known[checkpoint] = true;
+        }
+    }
+
+    fclose(file);
+    return E_OK;
+}
+
+//.. Whether the hash of `entry` at checkpoint `checkpoint` goes into the
+//   golden file: the new one when the entry ran, and the old one otherwise.
+//   `hash` is set to it.
+static bool
+golden_value(const struct GoldenEntry* entry, size_t checkpoint, uint64_t* hash)
+{
+    if (entry->err == E_OK) {
+        *hash = entry->hashes[checkpoint];
+        return true;
+    }
+
+    if (entry->expected == NULL || !entry->known[checkpoint])
+        return false;
+
+    *hash = entry->expected[checkpoint];
+    return true;
+}
+
+//.. Whether an entry in front of `index` already writes the value at `frame`
+static bool
+written_before(const struct GoldenRun* run, size_t index, unsigned long frame)
+{
+    const struct GoldenEntry* entry = &run->entries[index];
+
+    for (size_t i = 0; i < index; i++) {
+        const struct GoldenEntry* other = &run->entries[i];
+        const long checkpoint = checkpoint_at(other, frame);
+        uint64_t hash;
+        if (checkpoint >= 0 && strcmp(other->key, entry->key) == 0 &&
+            golden_value(other, checkpoint, &hash))
+            return true;
+    }
+
+    return false;
+}
+
+static enum Error
+write_golden(const struct GoldenRun* run, const char* golden_path)
+{
+    FILE* file = fopen(golden_path, "w");
+    if (file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    for (size_t i = 0; i < run->entry_count; i++) {
+        const struct GoldenEntry* entry = &run->entries[i];
+
+        //.. A run that failed keeps the values it had
+        if (entry->err != E_OK) {
+            printf("%s %s (line %u), it failed to run\n",
+                   entry->expected != NULL ? "Kept the old golden values of" : "No golden values for",
+                   entry->rom_path, entry->line);
+        }
+
+        for (size_t checkpoint = 0; checkpoint < entry->checkpoint_count; checkpoint++) {
+            const unsigned long frame = checkpoint_frame(entry, checkpoint);
+            uint64_t hash;
+            if (golden_value(entry, checkpoint, &hash) && !written_before(run, i, frame))
+                fprintf(file, "%s %lu %016" PRIx64 "\n", entry->key, frame, hash);
+        }
+    }
+
+    const bool failed = ferror(file);
+    fclose(file);
+    return failed ? E_COULDNT_WRITE_FILE : E_OK;
+}
+
+static bool
+report(const struct GoldenRun* run)
+{
+    size_t failures = 0;
+
+    for (size_t i = 0; i < run->entry_count; i++) {
+        const struct GoldenEntry* entry = &run->entries[i];
+
+        if (entry->err != E_OK) {
+            printf("FAIL %s (line %u): %s at frame %lu\n", entry->rom_path,
+                   entry->line, error_to_str(entry->err), entry->error_frame);
+        } else if (entry->mismatch) {
+            const size_t checkpoint = entry->mismatch_checkpoint;
+            const unsigned long frame = checkpoint_frame(entry, checkpoint);
+            printf("FAIL %s (line %u): frame %lu hashed %016" PRIx64
+                   ", expected %016" PRIx64 "\n", entry->rom_path, entry->line,
+                   frame, entry->hashes[checkpoint], entry->expected[checkpoint]);
+
+            if (entry->png_err == E_OK)
+                printf("     display written to %s.%u.%lu.png\n",
+                       run->manifest_path, entry->line, frame);
+        } else if (entry->expected == NULL && !run->regenerate) {
+            printf("FAIL %s (line %u): no golden values\n", entry->rom_path, entry->line);
+        } else if (entry->missing) {
+            printf("FAIL %s (line %u): no golden value for frame %lu\n", entry->rom_path,
+                   entry->line, checkpoint_frame(entry, entry->missing_checkpoint));
+        } else {
+            continue;
+        }
+
+        failures++;
+    }
+
+    printf("%zu of %zu ROMs passed\n", run->entry_count - failures, run->entry_count);
+    return failures == 0;
+}
+
+enum Error
+golden_run(const char* manifest_path, bool regenerate, bool* passed)
+{
+    struct GoldenRun run = {
+        .entries = NULL,
+        .manifest_path = manifest_path,
+        .regenerate = regenerate,
+    };
+
+    char golden_path[MAX_PATH + 8];
+    snprintf(golden_path, sizeof(golden_path), "%s.golden", manifest_path);
+
+    //.. Also read when regenerating, for the entries that fail to run
+    enum Error err = read_manifest(&run);
+    if (err == E_OK)
+        err = read_golden(&run, golden_path);
+    if (err != E_OK)
+        goto cleanup;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        cores = 1;
+    const size_t worker_count = (size_t) cores < run.entry_count ? (size_t) cores : run.entry_count;
+
+    pthread_t* workers = malloc(worker_count * sizeof(pthread_t));
+    size_t started = 0;
+    for (; workers != NULL && started < worker_count; started++) {
+        if (pthread_create(&workers[started], NULL, worker, &run) != 0)
+            break;
+    }
+    //.. Do the remaining work on this thread if no worker could be started
+    if (started == 0)
+        worker(&run);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *passed = report(&run);
+    printf("Ran in %.3f s on %zu threads\n",
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+           started > 0 ? started : 1);
+
+    if (regenerate) {
+        err = write_golden(&run, golden_path);
+        if (err == E_OK)
+            printf("Golden values written to %s\n", golden_path);
+    }
+
+    cleanup:
+        for (size_t i = 0; i < run.entry_count; i++) {
+            free(run.entries[i].hashes);
+            free(run.entries[i].expected);
+            free(run.entries[i].known);
+        }
+        free(run.entries);
+
+        return err;
+}
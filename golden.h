@@ -0,0 +1,34 @@
+#ifndef GOLDEN_H_
+#define GOLDEN_H_
+
+#include "error.h"
+
+#include <stdbool.h>
+
+/* Golden-image regression runs
+ *
+ * A manifest lists ROMs to run headless, one per line:
+ *
+ *     # rom            frames  profile  [frame:keypad ...]
+ *     roms/pong.ch8    600     modern   60:0002 90:0000
+ *
+ * Paths are relative to the manifest. Each `frame:keypad` pair sets the
+ * keypad bitmask (hexadecimal, bit n is key n) from that frame on. Every
+ * GOLDEN_CHECKPOINT_INTERVAL frames, and after the last frame, the display
+ * and registers are hashed and compared with `<manifest>.golden`, where the
+ * values are filed under the ROM, profile, inputs and frame rather than the
+ * line. For the first mismatching checkpoint of a ROM the display is written
+ * to `<manifest>.<line>.<frame>.png`. When regenerating, ROMs that fail to
+ * run keep their old values.
+ *
+ * ROMs are distributed over all cores.
+ */
+
+#define GOLDEN_CHECKPOINT_INTERVAL 60
+#define GOLDEN_MAX_INPUTS          64
+//.. Fixed seed so RND is reproducible
+#define GOLDEN_RANDOM_SEED         0xC8C8C8C8
+
+enum Error golden_run(const char* manifest_path, bool regenerate, bool* passed);
+
+#endif
@@ -0,0 +1,230 @@
+#include "grid.h"
+#include "io.h"
+#include "quirks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//.. Tiles fit a high resolution display, low resolution pixels are doubled
+#define TILE_WIDTH  DISPLAY_MAX_WIDTH
+#define TILE_HEIGHT DISPLAY_MAX_HEIGHT
+
+//.. Halted VMs keep their last frame, drawn in red
+#define HALTED_COLOR 0xFFC00000
+
+enum Error
+grid_init(struct Grid* grid, unsigned int columns, unsigned int rows)
+{
+    *grid = (struct Grid) { .columns = columns, .rows = rows };
+
+    grid->tiles = calloc((size_t) columns * rows, sizeof(struct GridTile));
+    if (grid->tiles == NULL)
+        return E_OUT_OF_MEMORY;
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+        goto error;
+
+    //.. Largest whole pixel size that fits, but no larger than a single VM's
+    unsigned int pixel_size = WINDOW_WIDTH / TILE_WIDTH;
+    while (pixel_size > 1 &&
+           (columns * TILE_WIDTH * pixel_size > GRID_MAX_WINDOW_WIDTH ||
+            rows * TILE_HEIGHT * pixel_size > GRID_MAX_WINDOW_HEIGHT)
+    ) {
+        pixel_size--;
+    }
+
+    grid->window = SDL_CreateWindow(
+        "Chip-8 Emulator",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        columns * TILE_WIDTH * pixel_size, rows * TILE_HEIGHT * pixel_size,
+        SDL_WINDOW_SHOWN
+    );
+    if (grid->window == NULL)
+        goto error;
+
+    grid->renderer = SDL_CreateRenderer(grid->window, -1, SDL_RENDERER_ACCELERATED);
+    if (grid->renderer == NULL)
+        goto error;
+
+    grid->atlas = SDL_CreateTexture(
+        grid->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        columns * TILE_WIDTH, rows * TILE_HEIGHT
+    );
+    if (grid->atlas == NULL)
+        goto error;
+
+    pacer_init(&grid->pacer, FPS, false);
+    return E_OK;
+
+    error:
+        grid_quit(grid);
+        return E_SDL_ERROR;
+}
+
+//.. Read a ROM and pick its profile: the one listed in `quirk_database` if
+//   given and listed there, `quirks` otherwise. Errors are reported with the
+//   file they concern.
+static enum Error
+read_rom(const char* path, enum QuirkProfile quirks, const char* quirk_database,
+         struct Rom* rom, enum QuirkProfile* profile)
+{
+    enum Error err = vm_read_rom(path, rom);
+    if (err != E_OK) {
+        fprintf(stderr, "Error: %s: %s\n", path, error_to_str(err));
+        return err;
+    }
+
+    *profile = quirks;
+    if (quirk_database != NULL) {
+        enum QuirkProfile listed;
+        bool found;
+        if ((err = quirks_lookup(quirk_database, rom->hash, &listed, &found)) != E_OK) {
+            fprintf(stderr, "Error: %s: %s\n", quirk_database, error_to_str(err));
+            vm_free_rom(rom);
+        } else if (found) {
+            *profile = listed;
+        }
+    }
+
+    return err;
+}
+
+//.. Fill the tiles with the given ROMs, repeating them when there are more
+//   tiles than ROMs. Every ROM is read once, and runs with the profile
+//   `quirk_database` lists for it when that's given.
+enum Error
+grid_load(struct Grid* grid, char* const rom_paths[], size_t rom_count,
+          enum QuirkProfile quirks, const char* quirk_database)
+{
+    struct Rom* roms = calloc(rom_count, sizeof(struct Rom));
+    enum QuirkProfile* profiles = calloc(rom_count, sizeof(enum QuirkProfile));
+    enum Error err = E_OK;
+    if (roms == NULL || profiles == NULL) {
+        err = E_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < rom_count; i++) {
+        if ((err = read_rom(rom_paths[i], quirks, quirk_database, &roms[i], &profiles[i])) != E_OK)
+            goto cleanup;
+    }
+
+    for (size_t i = 0; i < (size_t) grid->columns * grid->rows; i++) {
+        struct GridTile* tile = &grid->tiles[i];
+        const size_t rom = i % rom_count;
+        if ((err = vm_alloc(&tile->vm, profiles[rom])) != E_OK)
+            goto cleanup;
+        //.. Give every instance its own random sequence
+        tile->vm->random_state += 2 * i;
+
+        if ((err = vm_load_rom(tile->vm, roms[rom].bytes, roms[rom].size)) != E_OK) {
+            fprintf(stderr, "Error: %s: %s\n", rom_paths[rom], error_to_str(err));
+            goto cleanup;
+        }
+    }
+
+    cleanup:
+        if (roms != NULL) {
+            for (size_t i = 0; i < rom_count; i++)
+                vm_free_rom(&roms[i]);
+        }
+        free(roms);
+        free(profiles);
+        return err;
+}
+
+static enum Error
+upload_tile(struct Grid* grid, size_t index)
+{
+    struct GridTile* tile = &grid->tiles[index];
+
+    const unsigned int scale = TILE_WIDTH / vm_display_width(tile->vm);
+    uint32_t pixels[TILE_HEIGHT][TILE_WIDTH];
+    for (int row = 0; row < TILE_HEIGHT; row++) {
+        for (int column = 0; column < TILE_WIDTH; column++) {
+            const uint8_t color = vm_pixel(tile->vm, row / scale, column / scale);
+            pixels[row][column] = tile->halted && color != 0
+                ? HALTED_COLOR
+                : PLANE_COLORS[color];
+        }
+    }
+
+    const SDL_Rect rect = {
+        .x = (index % grid->columns) * TILE_WIDTH,
+        .y = (index / grid->columns) * TILE_HEIGHT,
+        .w = TILE_WIDTH,
+        .h = TILE_HEIGHT,
+    };
+    if (SDL_UpdateTexture(grid->atlas, &rect, pixels, sizeof(pixels[0])) != 0)
+        return E_SDL_ERROR;
+
+    tile->uploaded_pixel_hash = tile->vm->pixel_hash;
+    tile->uploaded = true;
+    return E_OK;
+}
+
+//.. Run every VM for a frame and upload the tiles whose display changed
+static enum Error
+update_tiles(struct Grid* grid, uint16_t keypad)
+{
+    for (size_t i = 0; i < (size_t) grid->columns * grid->rows; i++) {
+        struct GridTile* tile = &grid->tiles[i];
+        if (tile->halted)
+            continue;
+
+        tile->vm->keypad = keypad;
+        enum Error err = vm_run_frame(tile->vm);
+        if (err != E_OK) {
+            fprintf(stderr, "Error: tile %zu halted: %s\n", i, error_to_str(err));
+            tile->halted = true;
+            tile->uploaded = false;
+        }
+
+        if (tile->uploaded && tile->uploaded_pixel_hash == tile->vm->pixel_hash)
+            continue;
+
+        if ((err = upload_tile(grid, i)) != E_OK)
+            return err;
+    }
+
+    return E_OK;
+}
+
+//.. Run until the window is closed. Keyboard input goes to every VM.
+enum Error
+grid_run(struct Grid* grid)
+{
+    while (!io_poll_quit()) {
+        enum Error err = update_tiles(grid, io_keypad());
+        if (err != E_OK)
+            return err;
+
+        pacer_wait(&grid->pacer);
+        if (SDL_RenderCopy(grid->renderer, grid->atlas, NULL, NULL) != 0)
+            return E_SDL_ERROR;
+        SDL_RenderPresent(grid->renderer);
+        pacer_mark_present(&grid->pacer);
+    }
+
+    return E_OK;
+}
+
+void
+grid_quit(struct Grid* grid)
+{
+    if (grid->atlas != NULL)
+        SDL_DestroyTexture(grid->atlas);
+    if (grid->renderer != NULL)
+        SDL_DestroyRenderer(grid->renderer);
+    if (grid->window != NULL)
+        SDL_DestroyWindow(grid->window);
+
+    if (grid->tiles != NULL) {
+        for (size_t i = 0; i < (size_t) grid->columns * grid->rows; i++)
+            free(grid->tiles[i].vm);
+    }
+    free(grid->tiles);
+    grid->tiles = NULL;
+
+    SDL_Quit();
+}
@@ -0,0 +1,43 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include "error.h"
+#include "pacing.h"
+#include "vm.h"
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//.. Largest window the grid scales itself to
+#define GRID_MAX_WINDOW_WIDTH  1920
+#define GRID_MAX_WINDOW_HEIGHT 1080
+
+struct GridTile {
+    struct VM* vm;
+    bool halted;
+    //.. Pixel hash of the frame in the atlas, used to skip unchanged tiles
+    uint64_t uploaded_pixel_hash;
+    bool uploaded;
+};
+
+//.. Frontend running columns x rows VMs in a single window. Every VM is a tile
+//   in one streaming texture atlas, which is drawn with a single copy and
+//   presented once per frame.
+struct Grid {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* atlas;
+    unsigned int columns;
+    unsigned int rows;
+    struct GridTile* tiles;
+    struct Pacer pacer;
+};
+
+enum Error grid_init(struct Grid*, unsigned int columns, unsigned int rows);
+enum Error grid_load(struct Grid*, char* const rom_paths[], size_t rom_count,
+                     enum QuirkProfile, const char* quirk_database);
+enum Error grid_run(struct Grid*);
+void       grid_quit(struct Grid*);
+
+#endif
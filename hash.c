@@ -0,0 +1,195 @@
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//.. 64-bit FNV-1a, used for identifying ROMs
+uint64_t
+hash_bytes(const uint8_t* bytes, size_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+//.. O(1): only the small parts of the state are folded in here
+uint64_t
+vm_state_hash(const struct VM* vm)
+{
+    uint64_t hash = vm->state_hash ^ vm->pixel_hash;
+
+    hash ^= zobrist_key(HASH_SLOT_PROGRAM_COUNTER, vm->program_counter);
+    hash ^= zobrist_key(HASH_SLOT_ADDRESS_REGISTER, vm->address_register);
+    hash ^= zobrist_key(HASH_SLOT_DELAY_TIMER, vm->delay_timer);
+    hash ^= zobrist_key(HASH_SLOT_SOUND_TIMER, vm->sound_timer);
+    hash ^= zobrist_key(HASH_SLOT_STACK_LENGTH, vm->stack.length);
+    for (uint8_t i = 0; i < vm->stack.length; i++)
+        hash ^= zobrist_key(HASH_SLOT_STACK(i), vm->stack.contents[i]);
+
+    hash ^= zobrist_key(HASH_SLOT_PLANES, vm->planes);
+    hash ^= zobrist_key(HASH_SLOT_AUDIO_PITCH, vm->audio_pitch);
+    for (uint8_t i = 0; i < FLAG_REGISTERS; i++)
+        hash ^= zobrist_key(HASH_SLOT_FLAG_REGISTER(i), vm->flag_registers[i]);
+    for (uint8_t i = 0; i < AUDIO_PATTERN_SIZE; i++)
+        hash ^= zobrist_key(HASH_SLOT_AUDIO_PATTERN(i), vm->audio_pattern[i]);
+
+    return hash;
+}
+
+//.. Compute the incrementally maintained parts of the hash from scratch, for
+//   use after bulk changes such as loading a ROM.
+void
+hash_recompute(struct VM* vm)
+{
+    vm->state_hash = 0;
+    for (uint8_t x = 0; x < REGISTERS_SIZE; x++)
+        vm->state_hash ^= zobrist_key(HASH_SLOT_REGISTER(x), vm->data_registers[x]);
+
+    //.. Zero bytes have key 0, which skips most of XO-CHIP's memory
+    for (uint32_t address = 0; address < (uint32_t) vm_memory_size(vm); address += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &vm->memory[address], sizeof(word));
+        if (word == 0)
+            continue;
+
+        for (uint32_t i = address; i < address + sizeof(word); i++)
+            vm->state_hash ^= zobrist_key(HASH_SLOT_MEMORY(i), vm->memory[i]);
+    }
+
+    hash_recompute_display(vm);
+}
+
+//.. Compute the pixel hash from scratch, for after scrolling or clearing
+void
+hash_recompute_display(struct VM* vm)
+{
+    vm->pixel_hash = zobrist_key(HASH_SLOT_HIRES, vm->hires);
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        for (uint8_t row = 0; row < DISPLAY_MAX_HEIGHT; row++) {
+            for (uint8_t word = 0; word < DISPLAY_WORDS; word++) {
+                uint64_t bits = vm->display[plane][row][word];
+                for (; bits != 0; bits &= bits - 1) {
+                    const unsigned int column = word * 64 + 63 - __builtin_ctzll(bits);
+                    vm->pixel_hash ^= zobrist_key(HASH_SLOT_PIXEL(plane, row, column), 1);
+                }
+            }
+        }
+    }
+}
+
+/* State table
+ *
+ * Open addressing with linear probing. Slot value 0 marks an empty slot, so
+ * a state hash of 0 is stored as EMPTY_SUBSTITUTE instead.
+ */
+
+#define EMPTY_SLOT       0
+#define EMPTY_SUBSTITUTE 0x9E3779B97F4A7C15ULL
+//.. Grow when more than 3/4 of the slots are in use
+#define MAX_LOAD(capacity) ((capacity) / 4 * 3)
+
+static uint64_t
+table_key(uint64_t hash)
+{
+    return hash == EMPTY_SLOT ? EMPTY_SUBSTITUTE : hash;
+}
+
+enum Error
+state_table_new(struct StateTable* table, size_t initial_capacity)
+{
+    size_t capacity = 16;
+    while (capacity < initial_capacity)
+        capacity *= 2;
+
+    uint64_t* slots = calloc(capacity, sizeof(uint64_t));
+    if (slots == NULL)
+        return E_OUT_OF_MEMORY;
+
+    *table = (struct StateTable) {
+        .slots = slots,
+        .capacity = capacity,
+        .count = 0,
+    };
+    return E_OK;
+}
+
+//.. Returns the slot holding `key`, or the empty slot where it belongs
+static size_t
+find_slot(const uint64_t* slots, size_t capacity, uint64_t key)
+{
+    size_t index = key & (capacity - 1);
+    while (slots[index] != EMPTY_SLOT && slots[index] != key)
+        index = (index + 1) & (capacity - 1);
+
+    return index;
+}
+
+static enum Error
+grow(struct StateTable* table)
+{
+    const size_t capacity = table->capacity * 2;
+    uint64_t* slots = calloc(capacity, sizeof(uint64_t));
+    if (slots == NULL)
+        return E_OUT_OF_MEMORY;
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i] != EMPTY_SLOT)
+            slots[find_slot(slots, capacity, table->slots[i])] = table->slots[i];
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return E_OK;
+}
+
+//.. Add `hash` to the table. `inserted` is set to false when it was already
+//   present, i.e. when the state was visited before.
+enum Error
+state_table_insert(struct StateTable* table, uint64_t hash, bool* inserted)
+{
+    if (table->count + 1 > MAX_LOAD(table->capacity)) {
+        enum Error err = grow(table);
+        if (err != E_OK)
+            return err;
+    }
+
+    const uint64_t key = table_key(hash);
+    const size_t index = find_slot(table->slots, table->capacity, key);
+
+    *inserted = table->slots[index] == EMPTY_SLOT;
+    if (*inserted) {
+        table->slots[index] = key;
+        table->count++;
+    }
+
+    return E_OK;
+}
+
+bool
+state_table_contains(const struct StateTable* table, uint64_t hash)
+{
+    const uint64_t key = table_key(hash);
+    return table->slots[find_slot(table->slots, table->capacity, key)] == key;
+}
+
+void
+state_table_clear(struct StateTable* table)
+{
+    memset(table->slots, 0, table->capacity * sizeof(uint64_t));
+    table->count = 0;
+}
+
+void
+state_table_free(struct StateTable* table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
@@ -0,0 +1,101 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremental Zobrist-style hash of the whole machine state.
+ *
+ * Every (slot, value) pair has a pseudo-random 64-bit key and the state hash
+ * is the XOR of the keys of all slots. A write only has to XOR out the key of
+ * the old value and XOR in the key of the new one. Keys are derived with
+ * splitmix64 rather than looked up, as a table for all of memory would take
+ * 8 MB. Value 0 has key 0, so zeroed memory and unlit pixels cost nothing.
+ *
+ * Registers, memory and pixels are tracked incrementally through the
+ * functions below, the resolution is part of the pixel hash. The program
+ * counter, I, the stack, the timers and the other small parts are folded in
+ * by vm_state_hash(). The random number generator and the keypad are left
+ * out, so that states only differing in those are treated as duplicates.
+ */
+
+#define HASH_SLOT_REGISTER(x)        (x)
+#define HASH_SLOT_MEMORY(address)    (0x100 + (address))
+#define HASH_SLOT_PIXEL(plane, row, column) \
+    (0x20000 + (plane) * 0x2000 + (row) * DISPLAY_MAX_WIDTH + (column))
+#define HASH_SLOT_STACK(index)       (0x30000 + (index))
+#define HASH_SLOT_STACK_LENGTH       0x40000
+#define HASH_SLOT_PROGRAM_COUNTER    0x40001
+#define HASH_SLOT_ADDRESS_REGISTER   0x40002
+#define HASH_SLOT_DELAY_TIMER        0x40003
+#define HASH_SLOT_SOUND_TIMER        0x40004
+#define HASH_SLOT_HIRES              0x40005
+#define HASH_SLOT_PLANES             0x40006
+#define HASH_SLOT_AUDIO_PITCH        0x40007
+#define HASH_SLOT_FLAG_REGISTER(x)   (0x40100 + (x))
+#define HASH_SLOT_AUDIO_PATTERN(i)   (0x40200 + (i))
+
+static inline uint64_t
+zobrist_key(uint32_t slot, uint32_t value)
+{
+    if (value == 0)
+        return 0;
+
+    //.. splitmix64 finaliser
+    uint64_t z = ((uint64_t) slot << 32) | value;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline void
+hash_write_register(struct VM* vm, uint8_t x, uint8_t value)
+{
+    vm->state_hash ^= zobrist_key(HASH_SLOT_REGISTER(x), vm->data_registers[x])
+                    ^ zobrist_key(HASH_SLOT_REGISTER(x), value);
+    vm->data_registers[x] = value;
+}
+
+static inline void
+hash_write_memory(struct VM* vm, uint16_t address, uint8_t value)
+{
+    vm->state_hash ^= zobrist_key(HASH_SLOT_MEMORY(address), vm->memory[address])
+                    ^ zobrist_key(HASH_SLOT_MEMORY(address), value);
+    vm->memory[address] = value;
+    vm_mark_dirty(vm, address, 1);
+}
+
+//.. Flip the pixels set in `mask` in a word of a display row
+static inline void
+hash_flip_pixels(struct VM* vm, uint8_t plane, uint8_t row, uint8_t word, uint64_t mask)
+{
+    vm->display[plane][row][word] ^= mask;
+    for (; mask != 0; mask &= mask - 1) {
+        const unsigned int column = word * 64 + 63 - __builtin_ctzll(mask);
+        vm->pixel_hash ^= zobrist_key(HASH_SLOT_PIXEL(plane, row, column), 1);
+    }
+}
+
+uint64_t hash_bytes(const uint8_t*, size_t);
+uint64_t vm_state_hash(const struct VM*);
+void     hash_recompute(struct VM*);
+void     hash_recompute_display(struct VM*);
+
+//.. Set of visited state hashes, for dropping duplicate states in searches
+struct StateTable {
+    uint64_t* slots;
+    size_t capacity; /* Always a power of two */
+    size_t count;
+};
+
+enum Error state_table_new(struct StateTable*, size_t initial_capacity);
+enum Error state_table_insert(struct StateTable*, uint64_t hash, bool* inserted);
+bool       state_table_contains(const struct StateTable*, uint64_t hash);
+void       state_table_clear(struct StateTable*);
+void       state_table_free(struct StateTable*);
+
+#endif
@@ -1,15 +1,32 @@
 #include "instructions.h"
+#include "hash.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 
 #define TODO() \
     fprintf(stderr, "TODO: %s() not yet implemented in %s\n", __func__, __FILE__);\
     exit(EXIT_FAILURE);
 
 #define NEXT_INSTRUCTION (vm->program_counter += 2)
-#define SKIP_INSTRUCTION (vm->program_counter += 2 * 2)
+#define SKIP_INSTRUCTION (vm->program_counter += 2 + skipped_length(vm))
+#define KEY_PRESSED(value) ((vm->keypad >> ((value) & 0xF)) & 1)
+
+//.. Length of the instruction after the current one. XO-CHIP's F000 NNNN is
+//   four bytes long, the other machines don't have it.
+static inline uint16_t
+skipped_length(const struct VM* vm)
+{
+    const uint32_t next = vm->program_counter + 2;
+
+    if (vm->quirks == QUIRKS_XOCHIP && next + 1 < (uint32_t) vm_memory_size(vm) &&
+        vm->memory[next] == 0xF0 && vm->memory[next + 1] == 0x00
+    )
+        return 4;
+
+    return 2;
+}
 
 enum Error
 instruction_sys(struct VM* vm, uint12_t nnn)
@@ -19,10 +36,23 @@ instruction_sys(struct VM* vm, uint12_t nnn)
     return E_OK;
 }
 
+//.. Clears the selected bitplanes only, which is always just the first one
+//   outside of XO-CHIP
 enum Error
 instruction_cls(struct VM* vm)
 {
-    io_clear_display(&vm->io);
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (vm->planes & (1 << plane))
+            memset(vm->display[plane], 0, sizeof(vm->display[plane]));
+    }
+
+    //.. Only XO-CHIP can leave a plane lit. An empty display hashes to just
+    //   its resolution, so the common case needs no scan of the planes.
+    if (vm->quirks != QUIRKS_XOCHIP || vm->planes == (1 << DISPLAY_PLANES) - 1)
+        vm->pixel_hash = zobrist_key(HASH_SLOT_HIRES, vm->hires);
+    else
+        hash_recompute_display(vm);
+
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -92,7 +122,7 @@ instruction_se_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
 enum Error
 instruction_ld_vx_byte(struct VM* vm, uint4_t x, uint8_t kk)
 {
-    vm->data_registers[x] = kk;
+    hash_write_register(vm, x, kk);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -100,7 +130,7 @@ instruction_ld_vx_byte(struct VM* vm, uint4_t x, uint8_t kk)
 enum Error
 instruction_add_vx_byte(struct VM* vm, uint4_t x, uint8_t kk)
 {
-    vm->data_registers[x] += kk;
+    hash_write_register(vm, x, vm->data_registers[x] + kk);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -108,7 +138,7 @@ instruction_add_vx_byte(struct VM* vm, uint4_t x, uint8_t kk)
 enum Error
 instruction_ld_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
 {
-    vm->data_registers[x] = vm->data_registers[y];
+    hash_write_register(vm, x, vm->data_registers[y]);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -116,7 +146,7 @@ instruction_ld_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
 enum Error
 instruction_or(struct VM* vm, uint4_t x, uint4_t y)
 {
-    vm->data_registers[x] |= vm->data_registers[y];
+    hash_write_register(vm, x, vm->data_registers[x] | vm->data_registers[y]);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -124,7 +154,7 @@ instruction_or(struct VM* vm, uint4_t x, uint4_t y)
 enum Error
 instruction_and(struct VM* vm, uint4_t x, uint4_t y)
 {
-    vm->data_registers[x] &= vm->data_registers[y];
+    hash_write_register(vm, x, vm->data_registers[x] & vm->data_registers[y]);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -132,7 +162,7 @@ instruction_and(struct VM* vm, uint4_t x, uint4_t y)
 enum Error
 instruction_xor(struct VM* vm, uint4_t x, uint4_t y)
 {
-    vm->data_registers[x] ^= vm->data_registers[y];
+    hash_write_register(vm, x, vm->data_registers[x] ^ vm->data_registers[y]);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -142,9 +172,9 @@ instruction_add_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
 {
     const uint16_t result = vm->data_registers[x] + vm->data_registers[y];
     //.. Set carry flag depending on whether result is greater than 8-bits
-    vm->data_registers[VF] = result > 0xFF;
+    hash_write_register(vm, VF, result > 0xFF);
     //.. Only store lowest 8 bits of result
-    vm->data_registers[x] = result & 0xFF;
+    hash_write_register(vm, x, result & 0xFF);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -152,19 +182,8 @@ instruction_add_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
 enum Error
 instruction_sub(struct VM* vm, uint4_t x, uint4_t y)
 {
-    vm->data_registers[VF] = (vm->data_registers[x] > vm->data_registers[y]);
-    vm->data_registers[x] -= vm->data_registers[y];
-
-    NEXT_INSTRUCTION;
-    return E_OK;
-}
-
-enum Error
-instruction_shr(struct VM* vm, uint4_t x, uint4_t y)
-{
-    //.. Set VF to the least-significant bit
-    vm->data_registers[VF] = vm->data_registers[x] & 1;
-    vm->data_registers[x] = vm->data_registers[x] >> 1;
+    hash_write_register(vm, VF, vm->data_registers[x] > vm->data_registers[y]);
+    hash_write_register(vm, x, vm->data_registers[x] - vm->data_registers[y]);
 
     NEXT_INSTRUCTION;
     return E_OK;
@@ -173,19 +192,8 @@ instruction_shr(struct VM* vm, uint4_t x, uint4_t y)
 enum Error
 instruction_subn(struct VM* vm, uint4_t x, uint4_t y)
 {
-    vm->data_registers[VF] = vm->data_registers[y] > vm->data_registers[x];
-    vm->data_registers[x] = vm->data_registers[y] - vm->data_registers[x];
-
-    NEXT_INSTRUCTION;
-    return E_OK;
-}
-
-enum Error
-instruction_shl(struct VM* vm, uint4_t x, uint4_t y)
-{
-    //.. Set VF to the most-significant bit
-    vm->data_registers[VF] = (vm->data_registers[x] & (1 << 7)) != 0;
-    vm->data_registers[x] = vm->data_registers[x] << 1;
+    hash_write_register(vm, VF, vm->data_registers[y] > vm->data_registers[x]);
+    hash_write_register(vm, x, vm->data_registers[y] - vm->data_registers[x]);
 
     NEXT_INSTRUCTION;
     return E_OK;
@@ -210,49 +218,10 @@ instruction_ld_i_addr(struct VM* vm, uint12_t nnn)
     return E_OK;
 }
 
-enum Error
-instruction_jp_v0_addr(struct VM* vm, uint12_t nnn)
-{
-    vm->program_counter = vm->data_registers[0] + nnn;
-    return E_OK;
-}
-
 enum Error
 instruction_rnd(struct VM* vm, uint4_t x, uint8_t kk)
 {
-    vm->data_registers[x] = (rand() % 255) & kk;
-    NEXT_INSTRUCTION;
-    return E_OK;
-}
-
-enum Error
-instruction_drw(struct VM* vm, uint4_t x, uint4_t y, uint4_t n)
-{
-    const uint8_t Vx = vm->data_registers[x] % DISPLAY_WIDTH;
-    const uint8_t Vy = vm->data_registers[y] % DISPLAY_HEIGHT;
-    vm->data_registers[VF] = 0;
-
-    for (int height = 0; height < n; height++) {
-        const uint8_t sprite_byte = vm->memory[vm->address_register + height];
-
-        for (int bit_n = 0; bit_n < 8; bit_n++) {
-            const bool sprite_bit = (sprite_byte >> (7 - bit_n)) & 1;
-
-            if (sprite_bit) {
-                if (vm->io.pixel_map[Vy + height][Vx + bit_n]) {
-                    vm->io.pixel_map[Vy + height][Vx + bit_n] = false;
-                    vm->data_registers[VF] = 1;
-                } else {
-                    vm->io.pixel_map[Vy + height][Vx + bit_n] = true;
-                }
-            }
-       }
-    }
-
-    enum Error err = io_update_display(&vm->io);
-    if (err != E_OK)
-        return err;
-
+    hash_write_register(vm, x, (vm_random(vm) % 255) & kk);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -260,7 +229,7 @@ instruction_drw(struct VM* vm, uint4_t x, uint4_t y, uint4_t n)
 enum Error
 instruction_skp(struct VM* vm, uint4_t x)
 {
-    if (io_is_key_pressed(vm->data_registers[x]))
+    if (KEY_PRESSED(vm->data_registers[x]))
         SKIP_INSTRUCTION;
     else
         NEXT_INSTRUCTION;
@@ -271,7 +240,7 @@ instruction_skp(struct VM* vm, uint4_t x)
 enum Error
 instruction_sknp(struct VM* vm, uint4_t x)
 {
-    if (!io_is_key_pressed(vm->data_registers[x]))
+    if (!KEY_PRESSED(vm->data_registers[x]))
         SKIP_INSTRUCTION;
     else
         NEXT_INSTRUCTION;
@@ -282,18 +251,7 @@ instruction_sknp(struct VM* vm, uint4_t x)
 enum Error
 instruction_ld_vx_dt(struct VM* vm, uint4_t x)
 {
-    //.. Determine the value for the delay timer by comparing the UNIX
-    //   timestamp from setting the delay timer to the UNIX timestamp of, now,
-    //   reading the delay timer.
-    const unsigned long sec_since_delay_timer_update =
-        time(NULL) - vm->delay_timer_last_update;
-
-    if (sec_since_delay_timer_update > vm->delay_timer)
-        vm->delay_timer = 0;
-    else
-        vm->delay_timer = sec_since_delay_timer_update;
-
-    vm->data_registers[x] = vm->delay_timer;
+    hash_write_register(vm, x, vm->delay_timer);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -301,12 +259,23 @@ instruction_ld_vx_dt(struct VM* vm, uint4_t x)
 enum Error
 instruction_ld_vx_k(struct VM* vm, uint4_t x)
 {
-    int8_t key_value = io_pressed_key();
+    //.. When multiple keys are pressed, the value of the first one in order
+    //   from top left to bottom right on the keypad is taken.
+    static const uint4_t KEYPAD_ORDER[] = {
+        0x1, 0x2, 0x3, 0xC,
+        0x4, 0x5, 0x6, 0xD,
+        0x7, 0x8, 0x9, 0xE,
+        0xA, 0x0, 0xB, 0xF,
+    };
+
     //.. If no key was pressed, NEXT_INSTRUCTION won't be called, in which case
     //   this instruction will be repeatedly called.
-    if (key_value >= 0) {
-        vm->data_registers[x] = key_value;
-        NEXT_INSTRUCTION;
+    for (size_t i = 0; i < sizeof(KEYPAD_ORDER); i++) {
+        if (KEY_PRESSED(KEYPAD_ORDER[i])) {
+            hash_write_register(vm, x, KEYPAD_ORDER[i]);
+            NEXT_INSTRUCTION;
+            break;
+        }
     }
     return E_OK;
 }
@@ -315,7 +284,6 @@ enum Error
 instruction_ld_dt_vx(struct VM* vm, uint4_t x)
 {
     vm->delay_timer = vm->data_registers[x];
-    vm->delay_timer_last_update = time(NULL);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -324,7 +292,6 @@ enum Error
 instruction_ld_st_vx(struct VM* vm, uint4_t x)
 {
     vm->sound_timer = vm->data_registers[x];
-    vm->sound_timer_last_update = time(NULL);
     NEXT_INSTRUCTION;
     return E_OK;
 }
@@ -353,30 +320,397 @@ instruction_ld_b_vx(struct VM* vm, uint4_t x)
     const uint8_t tens_digit = (Vx / 10) % 10;
     const uint8_t ones_digit = (Vx % 100) % 10;
 
-    vm->memory[vm->address_register] = hundreds_digit;
-    vm->memory[vm->address_register + 1] = tens_digit;
-    vm->memory[vm->address_register + 2] = ones_digit;
+    if (vm->address_register + 3 > vm_memory_size(vm))
+        return E_VM_OUT_OF_MEMORY;
+
+    hash_write_memory(vm, vm->address_register, hundreds_digit);
+    hash_write_memory(vm, vm->address_register + 1, tens_digit);
+    hash_write_memory(vm, vm->address_register + 2, ones_digit);
 
     NEXT_INSTRUCTION;
     return E_OK;
 }
 
+/* SUPER-CHIP and XO-CHIP instructions
+ *
+ * Only the interpreters of those profiles decode these, see execute_opcode()
+ * in vm.c. Scrolling applies to the selected bitplanes; as the display is
+ * packed per row, vertical scrolls move whole rows and horizontal ones shift
+ * words.
+ */
+
 enum Error
-instruction_ld_i_vx(struct VM* vm, uint4_t x)
+instruction_scd(struct VM* vm, uint4_t n)
 {
-    for (uint8_t i = 0; i <= x; i++)
-        vm->memory[vm->address_register+i] = vm->data_registers[i];
+    const unsigned int height = vm_display_height(vm);
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(vm->planes & (1 << plane)))
+            continue;
+
+        uint64_t (*rows)[DISPLAY_WORDS] = vm->display[plane];
+        memmove(&rows[n], &rows[0], (height - n) * sizeof(rows[0]));
+        memset(&rows[0], 0, n * sizeof(rows[0]));
+    }
+    hash_recompute_display(vm);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_scu(struct VM* vm, uint4_t n)
+{
+    const unsigned int height = vm_display_height(vm);
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(vm->planes & (1 << plane)))
+            continue;
+
+        uint64_t (*rows)[DISPLAY_WORDS] = vm->display[plane];
+        memmove(&rows[0], &rows[n], (height - n) * sizeof(rows[0]));
+        memset(&rows[height - n], 0, n * sizeof(rows[0]));
+    }
+    hash_recompute_display(vm);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_scr(struct VM* vm)
+{
+    const unsigned int words = vm_display_width(vm) / 64;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(vm->planes & (1 << plane)))
+            continue;
+
+        for (unsigned int row = 0; row < vm_display_height(vm); row++) {
+            uint64_t* line = vm->display[plane][row];
+            for (unsigned int word = words; word-- > 0;)
+                line[word] = (line[word] >> 4) | (word > 0 ? line[word - 1] << 60 : 0);
+        }
+    }
+    hash_recompute_display(vm);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_scl(struct VM* vm)
+{
+    const unsigned int words = vm_display_width(vm) / 64;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(vm->planes & (1 << plane)))
+            continue;
+
+        for (unsigned int row = 0; row < vm_display_height(vm); row++) {
+            uint64_t* line = vm->display[plane][row];
+            for (unsigned int word = 0; word < words; word++)
+                line[word] = (line[word] << 4) | (word + 1 < words ? line[word + 1] >> 60 : 0);
+        }
+    }
+    hash_recompute_display(vm);
 
     NEXT_INSTRUCTION;
     return E_OK;
 }
 
+//.. The machine halts: the program counter stays on this instruction
 enum Error
-instructon_ld_vx_i(struct VM* vm, uint4_t x)
+instruction_exit(struct VM* vm)
+{
+    return E_OK;
+}
+
+static void
+set_resolution(struct VM* vm, bool hires)
+{
+    vm->hires = hires;
+    memset(vm->display, 0, sizeof(vm->display));
+    hash_recompute_display(vm);
+}
+
+enum Error
+instruction_low(struct VM* vm)
+{
+    set_resolution(vm, false);
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_high(struct VM* vm)
+{
+    set_resolution(vm, true);
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_ld_hf_vx(struct VM* vm, uint4_t x)
+{
+    vm->address_register = BIG_FONT_START + 10 * (vm->data_registers[x] & 0xF);
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_ld_r_vx(struct VM* vm, uint4_t x)
+{
+    memcpy(vm->flag_registers, vm->data_registers, x + 1);
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_ld_vx_r(struct VM* vm, uint4_t x)
 {
     for (int i = 0; i <= x; i++)
-        vm->data_registers[i] = vm->memory[vm->address_register+i];
+        hash_write_register(vm, i, vm->flag_registers[i]);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+//.. Store VX to VY at I, in descending order when X > Y. I is left as is.
+enum Error
+instruction_save_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
+{
+    const int step = x <= y ? 1 : -1;
+    const unsigned int count = (x <= y ? y - x : x - y) + 1;
+    if (vm->address_register + (int) count > vm_memory_size(vm))
+        return E_VM_OUT_OF_MEMORY;
+
+    for (unsigned int i = 0; i < count; i++)
+        hash_write_memory(vm, vm->address_register + i, vm->data_registers[x + step * (int) i]);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_load_vx_vy(struct VM* vm, uint4_t x, uint4_t y)
+{
+    const int step = x <= y ? 1 : -1;
+    const unsigned int count = (x <= y ? y - x : x - y) + 1;
+    if (vm->address_register + (int) count > vm_memory_size(vm))
+        return E_VM_OUT_OF_MEMORY;
+
+    for (unsigned int i = 0; i < count; i++)
+        hash_write_register(vm, x + step * (int) i, vm->memory[vm->address_register + i]);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+//.. F000 NNNN: load I with the 16-bit address in the next two bytes
+enum Error
+instruction_ld_i_long(struct VM* vm)
+{
+    if (vm->program_counter + 4 > vm_memory_size(vm))
+        return E_VM_OUT_OF_MEMORY;
+
+    vm->address_register = (vm->memory[vm->program_counter + 2] << 8) |
+                           vm->memory[vm->program_counter + 3];
+    vm->program_counter += 4;
+    return E_OK;
+}
+
+enum Error
+instruction_plane(struct VM* vm, uint4_t n)
+{
+    vm->planes = n & ((1 << DISPLAY_PLANES) - 1);
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+//.. Load the 1-bit audio pattern from I. Sound still only rings the bell.
+enum Error
+instruction_audio(struct VM* vm)
+{
+    if (vm->address_register + AUDIO_PATTERN_SIZE > vm_memory_size(vm))
+        return E_VM_OUT_OF_MEMORY;
+
+    memcpy(vm->audio_pattern, &vm->memory[vm->address_register], AUDIO_PATTERN_SIZE);
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+enum Error
+instruction_pitch(struct VM* vm, uint4_t x)
+{
+    vm->audio_pitch = vm->data_registers[x];
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+/* Quirk-dependent instructions
+ *
+ * Interpreters disagree on the behaviour of the instructions below. They are
+ * written once with the quirk as a parameter and DEFINE_QUIRK_INSTRUCTIONS
+ * stamps out a copy per profile with the quirks as constants, so the compiler
+ * removes the quirk branches from every copy.
+ */
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static ALWAYS_INLINE enum Error
+shr(struct VM* vm, uint4_t x, uint4_t y, const bool shift_uses_vy)
+{
+    const uint8_t source = vm->data_registers[shift_uses_vy ? y : x];
+    //.. Set VF to the least-significant bit
+    hash_write_register(vm, VF, source & 1);
+    hash_write_register(vm, x, source >> 1);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+static ALWAYS_INLINE enum Error
+shl(struct VM* vm, uint4_t x, uint4_t y, const bool shift_uses_vy)
+{
+    const uint8_t source = vm->data_registers[shift_uses_vy ? y : x];
+    //.. Set VF to the most-significant bit
+    hash_write_register(vm, VF, (source & (1 << 7)) != 0);
+    hash_write_register(vm, x, source << 1);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+static ALWAYS_INLINE enum Error
+jp_v0_addr(struct VM* vm, uint12_t nnn, const bool jump_uses_vx)
+{
+    //.. SUPER-CHIP reads BNNN as BXNN and jumps to XNN + VX
+    const uint4_t x = jump_uses_vx ? (nnn >> 8) & 0xF : 0;
+    vm->program_counter = vm->data_registers[x] + nnn;
+    return E_OK;
+}
+
+static ALWAYS_INLINE enum Error
+drw(struct VM* vm, uint4_t x, uint4_t y, uint4_t n, const bool draw_wraps,
+    const bool schip_instructions, const bool xochip_instructions)
+{
+    //.. Constants outside of SUPER-CHIP and XO-CHIP, where rows are one word
+    const bool hires = schip_instructions && vm->hires;
+    const unsigned int width = hires ? DISPLAY_MAX_WIDTH : DISPLAY_WIDTH;
+    const unsigned int height = hires ? DISPLAY_MAX_HEIGHT : DISPLAY_HEIGHT;
+    const uint8_t planes = xochip_instructions ? vm->planes : 1;
+
+    //.. SUPER-CHIP draws a 16x16 sprite for DXY0
+    const bool big_sprite = schip_instructions && n == 0;
+    const unsigned int sprite_width = big_sprite ? 16 : 8;
+    const unsigned int sprite_rows = big_sprite ? 16 : n;
+    const unsigned int plane_length = sprite_rows * sprite_width / 8;
+
+    //.. Planes are drawn with consecutive sprites
+    if (vm->address_register + plane_length * __builtin_popcount(planes) >
+        PROFILE_MEMORY_SIZE(xochip_instructions)
+    )
+        return E_VM_OUT_OF_MEMORY;
+
+    //.. The start position always wraps, the quirk decides whether the parts
+    //   of the sprite beyond the edge wrap around or are clipped. A sprite row
+    //   covers at most two words of a display row; the second one lies beyond
+    //   the right edge when the first is the last word.
+    const unsigned int Vx = vm->data_registers[x] % width;
+    const unsigned int Vy = vm->data_registers[y] % height;
+    const unsigned int word = Vx / 64;
+    const unsigned int shift = Vx % 64;
+    const bool spills_over_edge = word + 1 == width / 64;
+    const unsigned int spill_word = spills_over_edge ? 0 : word + 1;
+
+    bool collision = false;
+    uint16_t address = vm->address_register;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(planes & (1 << plane)))
+            continue;
+
+        const uint8_t* sprite = &vm->memory[address];
+        address += plane_length;
+
+        for (unsigned int sprite_row = 0; sprite_row < sprite_rows; sprite_row++) {
+            unsigned int row = Vy + sprite_row;
+            if (row >= height) {
+                if (!draw_wraps)
+                    break;
+                row -= height;
+            }
+
+            const uint64_t bits = big_sprite
+                ? (sprite[2 * sprite_row] << 8) | sprite[2 * sprite_row + 1]
+                : sprite[sprite_row];
+            const uint64_t aligned = bits << (64 - sprite_width);
+            const uint64_t left = aligned >> shift;
+            uint64_t right = shift > 0 ? aligned << (64 - shift) : 0;
+            if (spills_over_edge && !draw_wraps)
+                right = 0;
+
+            uint64_t* line = vm->display[plane][row];
+            collision |= (line[word] & left) != 0 || (line[spill_word] & right) != 0;
+            if (left != 0)
+                hash_flip_pixels(vm, plane, row, word, left);
+            if (right != 0)
+                hash_flip_pixels(vm, plane, row, spill_word, right);
+        }
+    }
+
+    hash_write_register(vm, VF, collision);
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+static ALWAYS_INLINE enum Error
+ld_i_vx(struct VM* vm, uint4_t x, const bool load_store_advances_i,
+        const bool xochip_instructions)
+{
+    if (vm->address_register + x + 1 > PROFILE_MEMORY_SIZE(xochip_instructions))
+        return E_VM_OUT_OF_MEMORY;
+
+    for (uint8_t i = 0; i <= x; i++)
+        hash_write_memory(vm, vm->address_register+i, vm->data_registers[i]);
+
+    if (load_store_advances_i)
+        vm->address_register += x + 1;
+
+    NEXT_INSTRUCTION;
+    return E_OK;
+}
+
+static ALWAYS_INLINE enum Error
+ld_vx_i(struct VM* vm, uint4_t x, const bool load_store_advances_i,
+        const bool xochip_instructions)
+{
+    if (vm->address_register + x + 1 > PROFILE_MEMORY_SIZE(xochip_instructions))
+        return E_VM_OUT_OF_MEMORY;
+
+    for (int i = 0; i <= x; i++)
+        hash_write_register(vm, i, vm->memory[vm->address_register+i]);
+
+    if (load_store_advances_i)
+        vm->address_register += x + 1;
+
     NEXT_INSTRUCTION;
     return E_OK;
 }
 
+#define DEFINE_QUIRK_INSTRUCTIONS(profile, shift_uses_vy, load_store_advances_i, jump_uses_vx, draw_wraps, schip_instructions, xochip_instructions) \
+    enum Error instruction_shr_##profile(struct VM* vm, uint4_t x, uint4_t y)\
+        { return shr(vm, x, y, shift_uses_vy); }\
+    enum Error instruction_shl_##profile(struct VM* vm, uint4_t x, uint4_t y)\
+        { return shl(vm, x, y, shift_uses_vy); }\
+    enum Error instruction_jp_v0_addr_##profile(struct VM* vm, uint12_t nnn)\
+        { return jp_v0_addr(vm, nnn, jump_uses_vx); }\
+    enum Error instruction_drw_##profile(struct VM* vm, uint4_t x, uint4_t y, uint4_t n)\
+        { return drw(vm, x, y, n, draw_wraps, schip_instructions, xochip_instructions); }\
+    enum Error instruction_ld_i_vx_##profile(struct VM* vm, uint4_t x)\
+        { return ld_i_vx(vm, x, load_store_advances_i, xochip_instructions); }\
+    enum Error instruction_ld_vx_i_##profile(struct VM* vm, uint4_t x)\
+        { return ld_vx_i(vm, x, load_store_advances_i, xochip_instructions); }
+
+//.. Profile                      shift_uses_vy  load_store_advances_i  jump_uses_vx  draw_wraps  schip_instructions  xochip_instructions
+DEFINE_QUIRK_INSTRUCTIONS(modern, false,         false,                 false,        true,       false,              false)
+DEFINE_QUIRK_INSTRUCTIONS(vip,    true,          true,                  false,        false,      false,              false)
+DEFINE_QUIRK_INSTRUCTIONS(schip,  false,         false,                 true,         false,      true,               false)
+DEFINE_QUIRK_INSTRUCTIONS(xochip, true,          true,                  false,        true,       true,               true)
@@ -4,6 +4,7 @@
 #include "error.h"
 #include "vm.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 //.. For clarity when addressing nibbles and 12-bit values
 typedef uint8_t uint4_t;
@@ -25,14 +26,10 @@ enum Error instruction_and(struct VM*, uint4_t x, uint4_t y);
 enum Error instruction_xor(struct VM*, uint4_t x, uint4_t y);
 enum Error instruction_add_vx_vy(struct VM*, uint4_t x, uint4_t y);
 enum Error instruction_sub(struct VM*, uint4_t x, uint4_t y);
-enum Error instruction_shr(struct VM*, uint4_t x, uint4_t y);
 enum Error instruction_subn(struct VM*, uint4_t x, uint4_t y);
-enum Error instruction_shl(struct VM*, uint4_t x, uint4_t y);
 enum Error instruction_sne_vx_vy(struct VM*, uint4_t x, uint4_t y);
 enum Error instruction_ld_i_addr(struct VM*, uint12_t nnn);
-enum Error instruction_jp_v0_addr(struct VM*, uint12_t nnn);
 enum Error instruction_rnd(struct VM*, uint4_t x, uint8_t kk);
-enum Error instruction_drw(struct VM*, uint4_t x, uint4_t y, uint4_t n);
 enum Error instruction_skp(struct VM*, uint4_t x);
 enum Error instruction_sknp(struct VM*, uint4_t x);
 enum Error instruction_ld_vx_dt(struct VM*, uint4_t x);
@@ -42,7 +39,53 @@ enum Error instruction_ld_st_vx(struct VM*, uint4_t x);
 enum Error instruction_add_i_vx(struct VM*, uint4_t x);
 enum Error instruction_ld_f_vx(struct VM*, uint4_t x);
 enum Error instruction_ld_b_vx(struct VM*, uint4_t x);
-enum Error instruction_ld_i_vx(struct VM*, uint4_t x);
-enum Error instructon_ld_vx_i(struct VM*, uint4_t x);
+
+//.. SUPER-CHIP
+enum Error instruction_scd(struct VM*, uint4_t n);
+enum Error instruction_scr(struct VM*);
+enum Error instruction_scl(struct VM*);
+enum Error instruction_exit(struct VM*);
+enum Error instruction_low(struct VM*);
+enum Error instruction_high(struct VM*);
+enum Error instruction_ld_hf_vx(struct VM*, uint4_t x);
+enum Error instruction_ld_r_vx(struct VM*, uint4_t x);
+enum Error instruction_ld_vx_r(struct VM*, uint4_t x);
+
+//.. XO-CHIP
+enum Error instruction_scu(struct VM*, uint4_t n);
+enum Error instruction_save_vx_vy(struct VM*, uint4_t x, uint4_t y);
+enum Error instruction_load_vx_vy(struct VM*, uint4_t x, uint4_t y);
+enum Error instruction_ld_i_long(struct VM*);
+enum Error instruction_plane(struct VM*, uint4_t n);
+enum Error instruction_audio(struct VM*);
+enum Error instruction_pitch(struct VM*, uint4_t x);
+
+//.. Instructions whose behaviour depends on the quirk profile. Every profile
+//   has its own copy, see DEFINE_QUIRK_INSTRUCTIONS in instructions.c.
+#define DECLARE_QUIRK_INSTRUCTIONS(profile) \
+    enum Error instruction_shr_##profile(struct VM*, uint4_t x, uint4_t y);\
+    enum Error instruction_shl_##profile(struct VM*, uint4_t x, uint4_t y);\
+    enum Error instruction_jp_v0_addr_##profile(struct VM*, uint12_t nnn);\
+    enum Error instruction_drw_##profile(struct VM*, uint4_t x, uint4_t y, uint4_t n);\
+    enum Error instruction_ld_i_vx_##profile(struct VM*, uint4_t x);\
+    enum Error instruction_ld_vx_i_##profile(struct VM*, uint4_t x);
+
+DECLARE_QUIRK_INSTRUCTIONS(modern)
+DECLARE_QUIRK_INSTRUCTIONS(vip)
+DECLARE_QUIRK_INSTRUCTIONS(schip)
+DECLARE_QUIRK_INSTRUCTIONS(xochip)
+
+struct QuirkInstructions {
+    enum Error (*shr)(struct VM*, uint4_t x, uint4_t y);
+    enum Error (*shl)(struct VM*, uint4_t x, uint4_t y);
+    enum Error (*jp_v0_addr)(struct VM*, uint12_t nnn);
+    enum Error (*drw)(struct VM*, uint4_t x, uint4_t y, uint4_t n);
+    enum Error (*ld_i_vx)(struct VM*, uint4_t x);
+    enum Error (*ld_vx_i)(struct VM*, uint4_t x);
+    //.. Whether the profile's interpreter decodes the extended instructions
+    bool schip_instructions;
+    bool xochip_instructions;
+    int memory_size;
+};
 
 #endif
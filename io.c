@@ -1,11 +1,19 @@
 #include "io.h"
 
+#include <stdio.h>
+#include <string.h>
+
 enum Error
 io_init(struct IO* io)
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         return E_SDL_ERROR;
 
+    enum Error err = E_SDL_ERROR;
+    io->renderer = NULL;
+    io->texture = NULL;
+    io->filter = (struct Filter) { .scaler = SCALER_NONE };
+
     SDL_Window* window = SDL_CreateWindow(
         "Chip-8 Emulator",
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -23,70 +31,248 @@ io_init(struct IO* io)
     if (renderer == NULL)
         goto error;
 
+    //.. For the translucent HUD background, everything else is opaque
+    if (SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND) != 0)
+        goto error;
     if (SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0) != 0)
         goto error;
     if (SDL_RenderClear(renderer) != 0)
         goto error;
     SDL_RenderPresent(renderer);
 
-    memset(io->pixel_map, false, sizeof(io->pixel_map));
-    io->ticks_at_last_draw = 0;
-    
+    io->texture = SDL_CreateTexture(
+        renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        WINDOW_WIDTH, WINDOW_HEIGHT
+    );
+    if (io->texture == NULL)
+        goto error;
+
+    if ((err = filter_init(&io->filter, WINDOW_WIDTH, WINDOW_HEIGHT, SCALER_NONE, 0)) != E_OK)
+        goto error;
+
+    pacer_init(&io->pacer, FPS, false);
+    io->frame_count = 0;
+    io->unpaced = false;
+    io->speed_window_start = SDL_GetPerformanceCounter();
+    io->speed_window_frames = 0;
+    io->shown_speed_percent = 100;
+    metrics_init(&io->metrics, FPS);
+    io->show_hud = false;
+    io->hud_key_held = false;
+
     return E_OK;
 
     error:
         io_quit(io);
-        return E_SDL_ERROR;
+        return err;
+}
+
+//.. Upscale the display with `scaler`, and keep `persistence_percent` of the
+//   previous frame's brightness in every new one
+enum Error
+io_set_filter(struct IO* io, enum Scaler scaler, unsigned int persistence_percent)
+{
+    filter_free(&io->filter);
+    return filter_init(&io->filter, WINDOW_WIDTH, WINDOW_HEIGHT, scaler, persistence_percent);
 }
 
+//.. Lock presentation to the display's vertical blank. Frames are still paced
+//   to FPS, vsync only removes tearing and the last bit of timer jitter.
 enum Error
-io_clear_display(struct IO* io)
+io_set_vsync(struct IO* io, bool enabled)
+{
+    if (SDL_RenderSetVSync(io->renderer, enabled) != 0)
+        return E_SDL_ERROR;
+
+    io->pacer.vsync = enabled;
+    return E_OK;
+}
+
+//.. 3x5 font of the HUD, one row per byte with the leftmost pixel in bit 2.
+//   Characters without a glyph are left blank.
+#define HUD_GLYPH_WIDTH  3
+#define HUD_GLYPH_HEIGHT 5
+
+static const uint8_t HUD_FONT[128][HUD_GLYPH_HEIGHT] = {
+    ['0'] = {7, 5, 5, 5, 7}, ['1'] = {2, 6, 2, 2, 7}, ['2'] = {7, 1, 7, 4, 7},
+    ['3'] = {7, 1, 7, 1, 7}, ['4'] = {5, 5, 7, 1, 1}, ['5'] = {7, 4, 7, 1, 7},
+    ['6'] = {7, 4, 7, 5, 7}, ['7'] = {7, 1, 1, 1, 1}, ['8'] = {7, 5, 7, 5, 7},
+    ['9'] = {7, 5, 7, 1, 7},
+    ['A'] = {2, 5, 7, 5, 5}, ['B'] = {6, 5, 6, 5, 6}, ['C'] = {3, 4, 4, 4, 3},
+    ['D'] = {6, 5, 5, 5, 6}, ['E'] = {7, 4, 6, 4, 7}, ['F'] = {7, 4, 6, 4, 4},
+    ['G'] = {3, 4, 5, 5, 3}, ['H'] = {5, 5, 7, 5, 5}, ['I'] = {7, 2, 2, 2, 7},
+    ['J'] = {1, 1, 1, 5, 2}, ['K'] = {5, 5, 6, 5, 5}, ['L'] = {4, 4, 4, 4, 7},
+    ['M'] = {5, 7, 7, 5, 5}, ['N'] = {6, 5, 5, 5, 5}, ['O'] = {2, 5, 5, 5, 2},
+    ['P'] = {6, 5, 6, 4, 4}, ['Q'] = {2, 5, 5, 6, 3}, ['R'] = {6, 5, 6, 5, 5},
+    ['S'] = {3, 4, 2, 1, 6}, ['T'] = {7, 2, 2, 2, 2}, ['U'] = {5, 5, 5, 5, 7},
+    ['V'] = {5, 5, 5, 5, 2}, ['W'] = {5, 5, 7, 7, 5}, ['X'] = {5, 5, 2, 5, 5},
+    ['Y'] = {5, 5, 2, 2, 2}, ['Z'] = {7, 1, 2, 4, 7},
+    ['.'] = {0, 0, 0, 0, 2}, [':'] = {0, 2, 0, 2, 0}, ['-'] = {0, 0, 7, 0, 0},
+    ['/'] = {1, 1, 2, 4, 4}, ['%'] = {5, 1, 2, 4, 5},
+};
+
+//.. Draw a line of text with its top left corner at `x`, `y`, in one batch
+static enum Error
+draw_text(SDL_Renderer* renderer, int x, int y, const char* text)
+{
+    SDL_Rect rects[HUD_MAX_LINE * HUD_GLYPH_WIDTH * HUD_GLYPH_HEIGHT];
+    int count = 0;
+
+    for (int i = 0; text[i] != '\0' && i < HUD_MAX_LINE; i++) {
+        const uint8_t* glyph = HUD_FONT[text[i] & 0x7F];
+        for (int row = 0; row < HUD_GLYPH_HEIGHT; row++) {
+            for (int col = 0; col < HUD_GLYPH_WIDTH; col++) {
+                if ((glyph[row] >> (HUD_GLYPH_WIDTH - 1 - col)) & 1) {
+                    rects[count++] = (SDL_Rect) {
+                        .x = x + (i * (HUD_GLYPH_WIDTH + 1) + col) * HUD_SCALE,
+                        .y = y + row * HUD_SCALE,
+                        .w = HUD_SCALE,
+                        .h = HUD_SCALE,
+                    };
+                }
+            }
+        }
+    }
+
+    return count == 0 || SDL_RenderFillRects(renderer, rects, count) == 0
+        ? E_OK
+        : E_SDL_ERROR;
+}
+
+//.. Overlay the rates of the last metrics window in the top left corner
+static enum Error
+draw_hud(struct IO* io)
 {
-    memset(io->pixel_map, false, sizeof(io->pixel_map));
-    
-    if (SDL_SetRenderDrawColor(io->renderer, 0, 0, 0, 0) != 0)
+    const struct Metrics* metrics = &io->metrics;
+    char lines[6][HUD_MAX_LINE + 1];
+    snprintf(lines[0], sizeof(lines[0]), "FPS %.1f", metrics->fps);
+    snprintf(lines[1], sizeof(lines[1]), "MIPS %.4f", metrics->mips);
+    snprintf(lines[2], sizeof(lines[2]), "FRAME %.2f MS", metrics->frame_ms);
+    snprintf(lines[3], sizeof(lines[3]), "JITTER %.2f MS", metrics->jitter_ms);
+    snprintf(lines[4], sizeof(lines[4]), "DRAW %.2f MS", metrics->display_ms);
+    snprintf(lines[5], sizeof(lines[5]), "DROPPED %llu",
+        (unsigned long long) metrics->frames_dropped);
+
+    const int line_count = sizeof(lines) / sizeof(lines[0]);
+    size_t longest = 0;
+    for (int i = 0; i < line_count; i++) {
+        if (strlen(lines[i]) > longest)
+            longest = strlen(lines[i]);
+    }
+
+    const int line_height = (HUD_GLYPH_HEIGHT + 2) * HUD_SCALE;
+    const SDL_Rect background = {
+        .x = 0, .y = 0,
+        .w = (longest * (HUD_GLYPH_WIDTH + 1) + 3) * HUD_SCALE,
+        .h = line_count * line_height + 2 * HUD_SCALE,
+    };
+    if (SDL_SetRenderDrawColor(io->renderer, 0, 0, 0, 0xC0) != 0 ||
+        SDL_RenderFillRect(io->renderer, &background) != 0)
         return E_SDL_ERROR;
-    if (SDL_RenderClear(io->renderer) != 0)
+
+    if (SDL_SetRenderDrawColor(io->renderer,
+            (HUD_COLOR >> 16) & 0xFF, (HUD_COLOR >> 8) & 0xFF, HUD_COLOR & 0xFF, 0xFF) != 0)
         return E_SDL_ERROR;
 
+    for (int i = 0; i < line_count; i++) {
+        const enum Error err = draw_text(io->renderer,
+            2 * HUD_SCALE, HUD_SCALE * 2 + i * line_height, lines[i]);
+        if (err != E_OK)
+            return err;
+    }
+
     return E_OK;
 }
 
 enum Error
-io_update_display(struct IO* io)
+io_update_display(struct IO* io, const struct VM* vm)
 {
     //.. Maintain a stable FPS
-    const unsigned int ticks_since_last_draw = (
-        SDL_GetTicks() - io->ticks_at_last_draw
-    );
-    if (ticks_since_last_draw < (1000/FPS)) {
-        SDL_Delay((1000/FPS) - ticks_since_last_draw);
-    }
+    if (io->unpaced)
+        pacer_restart(&io->pacer);
+    else
+        pacer_wait(&io->pacer);
+    const uint64_t start = SDL_GetPerformanceCounter();
 
-    if (SDL_SetRenderDrawColor(io->renderer, 0, 0, 0, 0) != 0)
+    //.. Toggle the HUD when its key goes down
+    const bool hud_key = SDL_GetKeyboardState(NULL)[HUD_KEY];
+    if (hud_key && !io->hud_key_held)
+        io->show_hud = !io->show_hud;
+    io->hud_key_held = hud_key;
+
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(io->texture, NULL, &pixels, &pitch) != 0)
         return E_SDL_ERROR;
-    if (SDL_RenderClear(io->renderer) != 0)
+    filter_run(&io->filter, vm, PLANE_COLORS, pixels, pitch / sizeof(uint32_t));
+    SDL_UnlockTexture(io->texture);
+
+    if (SDL_RenderCopy(io->renderer, io->texture, NULL, NULL) != 0)
         return E_SDL_ERROR;
 
-    if (SDL_SetRenderDrawColor(io->renderer, 255, 255, 255, 255) != 0)
+    if (io->show_hud && draw_hud(io) != E_OK)
         return E_SDL_ERROR;
 
-    SDL_Rect rect = { .w = PIXEL_SIZE, .h = PIXEL_SIZE };
-    for (int i = 0; i < DISPLAY_HEIGHT; i++) {
-        for (int j = 0; j < DISPLAY_WIDTH; j++) {
-            if (io->pixel_map[i][j]) {
-                rect.x = j * PIXEL_SIZE;
-                rect.y = i * PIXEL_SIZE;
-                if (SDL_RenderFillRect(io->renderer, &rect) != 0)
-                    return E_SDL_ERROR;
-            }
+    SDL_RenderPresent(io->renderer);
+    pacer_mark_present(&io->pacer);
+    metrics_count_present(&io->metrics, SDL_GetPerformanceCounter() - start, !io->unpaced);
+    io->frame_count++;
+
+    return E_OK;
+}
+
+//.. Handle pending window events, returns whether the user asked to quit.
+bool
+io_poll_quit()
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event) != 0) {
+        switch (event.type) {
+        case SDL_QUIT:
+            return true;
         }
     }
 
-    SDL_RenderPresent(io->renderer);
-    io->ticks_at_last_draw = SDL_GetTicks();
+    return false;
+}
 
-    return E_OK;
+bool
+io_fast_forward_held()
+{
+    return SDL_GetKeyboardState(NULL)[FAST_FORWARD_KEY];
+}
+
+//.. Count `emulated_frames` towards the effective speed, which is shown in the
+//   window title when it differs from normal speed.
+void
+io_show_speed(struct IO* io, unsigned long emulated_frames)
+{
+    io->speed_window_frames += emulated_frames;
+
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const uint64_t elapsed = now - io->speed_window_start;
+    const uint64_t window = SDL_GetPerformanceFrequency() * SPEED_UPDATE_MS / 1000;
+    if (elapsed < window)
+        return;
+
+    const double seconds = (double) elapsed / SDL_GetPerformanceFrequency();
+    unsigned int speed_percent = io->speed_window_frames / seconds / FPS * 100 + 0.5;
+    //.. Ignore the jitter of normal pacing
+    if (speed_percent >= 95 && speed_percent <= 105)
+        speed_percent = 100;
+
+    if (speed_percent != io->shown_speed_percent) {
+        char title[64];
+        if (speed_percent == 100)
+            snprintf(title, sizeof(title), "Chip-8 Emulator");
+        else
+            snprintf(title, sizeof(title), "Chip-8 Emulator (%.1fx)", speed_percent / 100.0);
+        SDL_SetWindowTitle(io->window, title);
+        io->shown_speed_percent = speed_percent;
+    }
+
+    io->speed_window_start = now;
+    io->speed_window_frames = 0;
 }
 
 void
@@ -124,39 +310,28 @@ io_is_key_pressed(int8_t value)
     return keyboard_state[VALUE_TO_KEYBOARD_MAP[value]];
 }
 
-//.. When multiple keys are pressed, the value of the first one in order from
-//   top left to bottom right is returned.
-int8_t
-io_pressed_key()
+//.. State of the whole keypad, bit n is set when the key with value n is
+//   pressed.
+uint16_t
+io_keypad()
 {
-    const uint8_t *keyboard_state = SDL_GetKeyboardState(NULL);
-    //.. First row
-    if (keyboard_state[SDL_SCANCODE_1])      return 1;
-    else if (keyboard_state[SDL_SCANCODE_2]) return 2;
-    else if (keyboard_state[SDL_SCANCODE_3]) return 3;
-    else if (keyboard_state[SDL_SCANCODE_4]) return 0xC;
-    //.. Second row
-    else if (keyboard_state[SDL_SCANCODE_Q]) return 4;
-    else if (keyboard_state[SDL_SCANCODE_W]) return 5;
-    else if (keyboard_state[SDL_SCANCODE_E]) return 6;
-    else if (keyboard_state[SDL_SCANCODE_R]) return 0xD;
-    //.. Third row
-    else if (keyboard_state[SDL_SCANCODE_A]) return 7;
-    else if (keyboard_state[SDL_SCANCODE_S]) return 8;
-    else if (keyboard_state[SDL_SCANCODE_D]) return 9;
-    else if (keyboard_state[SDL_SCANCODE_F]) return 0xE;
-    //.. Fourth row
-    else if (keyboard_state[SDL_SCANCODE_Z]) return 0xA;
-    else if (keyboard_state[SDL_SCANCODE_X]) return 0;
-    else if (keyboard_state[SDL_SCANCODE_C]) return 0xB;
-    else if (keyboard_state[SDL_SCANCODE_V]) return 0xF;
-    //..
-    else                                     return -1;
+    uint16_t keypad = 0;
+    for (int8_t value = 0; value <= 0xF; value++) {
+        if (io_is_key_pressed(value))
+            keypad |= 1 << value;
+    }
+
+    return keypad;
 }
 
 void
 io_quit(struct IO* io)
 {
+    filter_free(&io->filter);
+
+    if (io->texture != NULL)
+        SDL_DestroyTexture(io->texture);
+
     if (io->renderer != NULL)
         SDL_DestroyRenderer(io->renderer);
 
@@ -2,29 +2,69 @@
 #define IO_H_
 
 #include "error.h"
+#include "filter.h"
+#include "metrics.h"
+#include "pacing.h"
+#include "vm.h"
 
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 
-#define DISPLAY_WIDTH  64
-#define DISPLAY_HEIGHT 32
+//.. Size of a low resolution pixel, high resolution ones are half as large
 #define PIXEL_SIZE     16
 #define WINDOW_WIDTH   (DISPLAY_WIDTH * PIXEL_SIZE)
 #define WINDOW_HEIGHT  (DISPLAY_HEIGHT * PIXEL_SIZE)
 #define FPS            60
 
+//.. ARGB colours of the combinations of lit bitplanes, see vm_pixel()
+static const uint32_t PLANE_COLORS[1 << DISPLAY_PLANES] = {
+    0xFF000000, /* Unlit */
+    0xFFFFFFFF, /* First plane, all there is outside of XO-CHIP */
+    0xFFAAAAAA, /* Second plane */
+    0xFF555555, /* Both */
+};
+
+//.. Key held to fast-forward
+#define FAST_FORWARD_KEY SDL_SCANCODE_TAB
+//.. How often the effective speed in the window title is refreshed
+#define SPEED_UPDATE_MS  500
+
+//.. Key toggling the metrics HUD, and its scale and colour
+#define HUD_KEY           SDL_SCANCODE_F1
+#define HUD_SCALE         4
+#define HUD_COLOR         0xFF40FF40
+#define HUD_MAX_LINE      24
+
 struct IO {
     SDL_Window* window;
     SDL_Renderer* renderer;
-    bool pixel_map[DISPLAY_HEIGHT][DISPLAY_WIDTH];
-    unsigned int ticks_at_last_draw;
+    //.. Streaming texture of the window's size the filtered display is
+    //   written to, see filter.h
+    SDL_Texture* texture;
+    struct Filter filter;
+    struct Pacer pacer;
+    unsigned long frame_count;
+    //.. Present as soon as a frame is ready instead of pacing to FPS
+    bool unpaced;
+
+    uint64_t speed_window_start;
+    unsigned long speed_window_frames;
+    unsigned int shown_speed_percent;
+
+    struct Metrics metrics;
+    bool show_hud;
+    bool hud_key_held;
 };
 
 enum Error io_init(struct IO*);
-enum Error io_update_display(struct IO*);
-enum Error io_clear_display(struct IO*);
+enum Error io_set_vsync(struct IO*, bool);
+enum Error io_set_filter(struct IO*, enum Scaler, unsigned int persistence_percent);
+enum Error io_update_display(struct IO*, const struct VM*);
+bool       io_poll_quit();
 bool       io_is_key_pressed(int8_t);
-int8_t     io_pressed_key();
+uint16_t   io_keypad();
+bool       io_fast_forward_held();
+void       io_show_speed(struct IO*, unsigned long emulated_frames);
 void       io_beep();
 void       io_quit(struct IO*);
 
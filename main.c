@@ -1,45 +1,471 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <time.h>
+#include "io.h"
 #include "vm.h"
 #include "error.h"
+#include "server.h"
+#include "shm.h"
+#include "quirks.h"
+#include "golden.h"
+#include "grid.h"
+#include "movie.h"
+#include "batch.h"
+#include "debugger.h"
+#include "metrics.h"
 
 #define PRINT_ERROR(err) fprintf(stderr, "Error: %s\n", error_to_str(err));
 
+//.. How often the stats file given with -S is rewritten
+#define STATS_WRITE_MS 1000
+
+static void
+print_usage(const char* program)
+{
+    printf(
+        "CHIP-8 Emulator\n"
+        "Usage: %s [options] <path to ROM>\n"
+        "       %s -g <manifest> [-u]\n"
+        "       %s -w <columns>x<rows> [-q <profile> | -d <path>] <path to ROM>...\n"
+        "Options:\n"
+        "  -v  lock presentation to vsync\n"
+        "  -t  print frame time percentiles on exit\n"
+        "  -s <path>  accept control clients on a Unix domain socket\n"
+        "  -m <name>  export frames and registers to POSIX shared memory\n"
+        "  -M <name>  like -m, replacing a segment of that name left behind\n"
+        "  -a <frames>  run ahead this many frames to hide input lag\n"
+        "  -q <profile>  quirk profile: modern (default), vip, schip or xochip\n"
+        "  -d <path>  pick the quirk profile from a ROM hash database\n"
+        "  -g <manifest>  run the ROMs in a manifest headless against golden values\n"
+        "  -u  with -g, regenerate the golden values\n"
+        "  -w <columns>x<rows>  run a grid of VMs in one window, cycling through the ROMs\n"
+        "  -r <path>  record the keypad input of the session to a movie\n"
+        "  -p <path>  replay a movie headless before continuing interactively\n"
+        "  -f <frame>  with -p, stop replaying at this frame\n"
+        "  -x <speed>  fast-forward speed while Tab is held, 0 for uncapped (default)\n"
+        "  -D  start stopped in the debugger, type help at its prompt for commands\n"
+        "  -H  show the metrics HUD, F1 toggles it\n"
+        "  -F <scaler>  upscale the display with none (default) or scale2x\n"
+        "  -P <percent>  phosphor persistence, how much of a frame's brightness is\n"
+        "                kept in the next one (default 0)\n"
+        "  -S <path>  write metrics to a file every second, as JSON if it ends in .json\n"
+        "             and in the Prometheus text format otherwise\n"
+        "  -B <instances>[x<frames>]  run instances of the ROM headless and report their\n"
+        "                             memory use and throughput\n",
+        program, program, program
+    );
+}
+
+//.. Emulate one frame of `vm` and return the machine whose display should be
+//   shown. With run-ahead, the frame is followed by `run_ahead` speculative
+//   frames on a copy of the VM, so the shown display already reacts to the
+//   keys that are held now. The copy is thrown away afterwards; `vm` itself
+//   only ever advances by one frame.
+static const struct VM*
+emulate_frame(struct VM* vm, struct VM* ahead, unsigned int run_ahead, enum Error* err)
+{
+    if ((*err = vm_run_frame(vm)) != E_OK || run_ahead == 0)
+        return vm;
+
+    memcpy(ahead, vm, vm_size(vm->quirks));
+    for (unsigned int i = 0; i < run_ahead; i++) {
+        //.. An error in a speculative frame will surface when it is
+        //   emulated for real, until then show the last good frame.
+        if (vm_run_frame(ahead) != E_OK)
+            break;
+    }
+
+    return ahead;
+}
+
+static int
+run_grid(unsigned int columns, unsigned int rows, char* const rom_paths[],
+         size_t rom_count, enum QuirkProfile quirks, const char* quirk_database)
+{
+    struct Grid grid;
+    enum Error err = grid_init(&grid, columns, rows);
+    if (err != E_OK) {
+        PRINT_ERROR(err);
+        return EXIT_FAILURE;
+    }
+
+    if ((err = grid_load(&grid, rom_paths, rom_count, quirks, quirk_database)) == E_OK &&
+        (err = grid_run(&grid)) != E_OK
+    ) {
+        PRINT_ERROR(err);
+    }
+
+    grid_quit(&grid);
+    return err == E_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int
 main(int argc, char* argv[])
 {
-    if (argc != 2) {
-        printf("CHIP-8 Emulator\nUsage: %s <path to ROM>\n", argv[0]);
+    bool vsync = false;
+    bool report_timing = false;
+    const char* socket_path = NULL;
+    const char* shm_name = NULL;
+    bool shm_replace = false;
+    unsigned int run_ahead = 0;
+    const char* quirk_profile = NULL;
+    const char* quirk_database = NULL;
+    const char* golden_manifest = NULL;
+    bool regenerate_golden = false;
+    unsigned int grid_columns = 0, grid_rows = 0;
+    const char* record_path = NULL;
+    const char* playback_path = NULL;
+    unsigned long playback_frame = 0;
+    unsigned int fast_forward_speed = 0;
+    bool debugging = false;
+    bool show_hud = false;
+    const char* stats_path = NULL;
+    const char* scaler_name = NULL;
+    unsigned int persistence = 0;
+    unsigned long batch_instances = 0;
+    unsigned long batch_frames = BATCH_FRAMES;
+
+    int option;
+    while ((option = getopt(argc, argv, "vts:m:M:a:q:d:g:uw:r:p:f:x:DHS:F:P:B:")) != -1) {
+        switch (option) {
+        case 'v':
+            vsync = true;
+            break;
+        case 't':
+            report_timing = true;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'm':
+        case 'M':
+            shm_name = optarg;
+            shm_replace = option == 'M';
+            break;
+        case 'a':
+            run_ahead = strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            quirk_profile = optarg;
+            break;
+        case 'd':
+            quirk_database = optarg;
+            break;
+        case 'g':
+            golden_manifest = optarg;
+            break;
+        case 'u':
+            regenerate_golden = true;
+            break;
+        case 'w':
+            if (sscanf(optarg, "%ux%u", &grid_columns, &grid_rows) != 2 ||
+                grid_columns == 0 || grid_rows == 0
+            ) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'p':
+            playback_path = optarg;
+            break;
+        case 'f':
+            playback_frame = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            fast_forward_speed = strtoul(optarg, NULL, 10);
+            break;
+        case 'D':
+            debugging = true;
+            break;
+        case 'H':
+            show_hud = true;
+            break;
+        case 'S':
+            stats_path = optarg;
+            break;
+        case 'F':
+            scaler_name = optarg;
+            break;
+        case 'P':
+            persistence = strtoul(optarg, NULL, 10);
+            break;
+        case 'B':
+            if (sscanf(optarg, "%lux%lu", &batch_instances, &batch_frames) < 1 ||
+                batch_instances == 0
+            ) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (golden_manifest != NULL && optind == argc) {
+        bool passed = false;
+        enum Error err = golden_run(golden_manifest, regenerate_golden, &passed);
+        if (err != E_OK)
+            PRINT_ERROR(err);
+
+        return err == E_OK && passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (grid_columns > 0 && optind < argc) {
+        enum QuirkProfile quirks = QUIRKS_MODERN;
+        if (quirk_profile != NULL && !quirks_from_name(quirk_profile, &quirks)) {
+            fprintf(stderr, "Error: unknown quirk profile '%s'\n", quirk_profile);
+            return EXIT_FAILURE;
+        }
+
+        //.. As for a single ROM, -q overrides the database
+        return run_grid(grid_columns, grid_rows, &argv[optind], argc - optind, quirks,
+                        quirk_profile == NULL ? quirk_database : NULL);
+    }
+
+    //.. Recordings start at power-on and only hold whole frames
+    if (optind != argc - 1 ||
+        (record_path != NULL && (playback_path != NULL || socket_path != NULL || debugging))
+    ) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* rom_path = argv[optind];
+
+    enum Scaler scaler = SCALER_NONE;
+    if (scaler_name != NULL && !filter_scaler_from_name(scaler_name, &scaler)) {
+        fprintf(stderr, "Error: unknown scaler '%s'\n", scaler_name);
         return EXIT_FAILURE;
     }
 
-    struct VM vm;
-    enum Error err = vm_new(&vm);
+    //.. The profile is picked before the ROM is loaded, as it decides how much
+    //   memory the ROM can take
+    struct Rom rom;
+    enum Error err = vm_read_rom(rom_path, &rom);
     if (err != E_OK) {
         PRINT_ERROR(err);
         return EXIT_FAILURE;
     }
 
-    err = vm_insert_rom(&vm, argv[1]);
+    enum QuirkProfile quirks = QUIRKS_MODERN;
+    if (quirk_profile != NULL) {
+        if (!quirks_from_name(quirk_profile, &quirks)) {
+            fprintf(stderr, "Error: unknown quirk profile '%s'\n", quirk_profile);
+            vm_free_rom(&rom);
+            return EXIT_FAILURE;
+        }
+    } else if (quirk_database != NULL) {
+        bool found;
+        if ((err = quirks_lookup(quirk_database, rom.hash, &quirks, &found)) == E_OK && !found)
+            quirks = QUIRKS_MODERN;
+    }
+    //.. A movie is played with the profile it was recorded with
+    if (err == E_OK && playback_path != NULL)
+        err = movie_profile(playback_path, &quirks);
+
+    //.. The run-ahead copy is only needed, and so only allocated, with -a
+    struct VM* vm = NULL;
+    struct VM* ahead = NULL;
+    if (err == E_OK)
+        err = vm_alloc(&vm, quirks);
+    if (err == E_OK && run_ahead > 0)
+        err = vm_alloc(&ahead, quirks);
+    if (err == E_OK)
+        err = vm_load_rom(vm, rom.bytes, rom.size);
+    vm_free_rom(&rom);
     if (err != E_OK) {
         PRINT_ERROR(err);
-        vm_quit(&vm);
+        free(ahead);
+        free(vm);
         return EXIT_FAILURE;
     }
 
-    bool quit_flag = false;
-    while ((err = vm_next(&vm, &quit_flag)) == E_OK && !quit_flag) {
-        vm_print_debug(vm);
+    if (batch_instances > 0) {
+        if ((err = batch_benchmark(vm, batch_instances, batch_frames, stdout)) != E_OK)
+            PRINT_ERROR(err);
+        free(ahead);
+        free(vm);
+        return err == E_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (playback_path != NULL) {
+        struct Movie playback;
+        if ((err = movie_play(&playback, playback_path, vm)) == E_OK) {
+            err = movie_play_until(&playback, vm, playback_frame);
+            movie_close(&playback);
+        }
+
+        if (err != E_OK) {
+            fprintf(stderr, "Error: %s at frame %lu\n", error_to_str(err), vm->frame_count);
+            free(ahead);
+            free(vm);
+            return EXIT_FAILURE;
+        }
+        printf("Replayed %s up to frame %lu\n", playback_path, vm->frame_count);
     }
-    if (err != E_OK)
+
+    struct IO io;
+    if ((err = io_init(&io)) != E_OK) {
         PRINT_ERROR(err);
+        free(ahead);
+        free(vm);
+        return EXIT_FAILURE;
+    }
+
+    struct Server server;
+    struct ShmExport shm;
+    struct Movie recording;
+    struct Debugger debugger;
+    bool server_started = false;
+    bool shm_opened = false;
+    bool recording_started = false;
+
+    if (vsync && (err = io_set_vsync(&io, true)) != E_OK)
+        goto cleanup;
+    if ((scaler != SCALER_NONE || persistence > 0) &&
+        (err = io_set_filter(&io, scaler, persistence)) != E_OK)
+        goto cleanup;
+
+    if (socket_path != NULL) {
+        if ((err = server_start(&server, socket_path)) != E_OK)
+            goto cleanup;
+        server_started = true;
+    }
+
+    if (shm_name != NULL) {
+        if ((err = shm_export_open(&shm, shm_name, shm_replace)) != E_OK)
+            goto cleanup;
+        shm_opened = true;
+    }
+
+    if (record_path != NULL) {
+        if ((err = movie_record(&recording, record_path, vm)) != E_OK)
+            goto cleanup;
+        recording_started = true;
+    }
+
+    io.show_hud = show_hud;
+    uint64_t next_stats_write = SDL_GetPerformanceCounter();
+
+    if (debugging) {
+        debugger_init(&debugger);
+        puts("Stopped at power-on, type help for commands");
+    }
+
+    while (!io_poll_quit()) {
+        vm->keypad = io_keypad();
+        if (server_started) {
+            server_process_commands(&server, vm);
+            vm->keypad |= server.held_keys;
+        }
+
+        if (debugging && debugger.stopped) {
+            if (debugger_prompt(&debugger, vm, &err) == DEBUGGER_QUIT || err != E_OK)
+                break;
+            metrics_resume(&io.metrics);
+        }
+
+        const uint8_t sound_timer = vm->sound_timer;
+        const struct VM* shown = vm;
+        const bool fast_forward = io_fast_forward_held();
+        unsigned long frames = 0;
+        const uint64_t emulation_start = SDL_GetPerformanceCounter();
+        const uint64_t instructions = vm->instruction_count;
+
+        if (server_started && server.paused) {
+            //.. Single-stepped by a control client
+            for (; server.pending_steps > 0 && err == E_OK; server.pending_steps--)
+                err = vm_step(vm);
+            metrics_resume(&io.metrics);
+        } else if (!debugging || !debugger.stopped) {
+            //.. While fast-forwarding, only the last of `fast_forward_speed`
+            //   frames is presented. Uncapped, frames are emulated for the
+            //   length of a display frame and presented without pacing.
+            const uint64_t frame_end =
+                SDL_GetPerformanceCounter() + SDL_GetPerformanceFrequency() / FPS;
+            do {
+                const uint16_t keypad = vm->keypad;
+                if (debugging)
+                    err = debugger_run_frame(&debugger, vm);
+                else
+                    shown = emulate_frame(vm, ahead, fast_forward ? 0 : run_ahead, &err);
+                if (err == E_OK && recording_started)
+                    err = movie_record_frame(&recording, vm, keypad);
+                frames++;
+            } while (err == E_OK && fast_forward && !(debugging && debugger.stopped) &&
+                (fast_forward_speed == 0
+                    ? SDL_GetPerformanceCounter() < frame_end
+                    : frames < fast_forward_speed));
+        }
+        if (err != E_OK)
+            break;
+        metrics_count_emulation(&io.metrics, frames, vm->instruction_count - instructions,
+            SDL_GetPerformanceCounter() - emulation_start);
+
+        io.unpaced = fast_forward && fast_forward_speed == 0;
+        io_show_speed(&io, frames);
+
+        //.. Ring system bell when the sound timer is (re)started, muted while
+        //   fast-forwarding
+        if (vm->sound_timer > sound_timer && !fast_forward)
+            io_beep();
+
+        if (server_started)
+            server_publish(&server, vm);
+        if (shm_opened)
+            shm_export_publish(&shm, vm);
+
+        if ((err = io_update_display(&io, shown)) != E_OK)
+            break;
+
+        //.. The next write is a period from now, so that a stall doesn't cause
+        //   a write on every frame until the schedule catches up
+        const uint64_t now = SDL_GetPerformanceCounter();
+        if (stats_path != NULL && now >= next_stats_write) {
+            if ((err = metrics_write(&io.metrics, stats_path)) != E_OK)
+                break;
+            next_stats_write = now + SDL_GetPerformanceFrequency() * STATS_WRITE_MS / 1000;
+        }
+    }
+
+    cleanup:
+        if (err != E_OK)
+            PRINT_ERROR(err);
+
+        if (recording_started) {
+            const enum Error close_err = movie_close(&recording);
+            if (close_err != E_OK)
+                PRINT_ERROR(close_err);
+        }
+        if (shm_opened)
+            shm_export_close(&shm);
+        if (server_started)
+            server_stop(&server);
+
+        if (report_timing)
+            pacer_report(&io.pacer, stderr);
+
+        //.. Leave the final totals behind
+        if (stats_path != NULL) {
+            const enum Error stats_err = metrics_write(&io.metrics, stats_path);
+            if (stats_err != E_OK)
+                PRINT_ERROR(stats_err);
+        }
 
-    vm_quit(&vm);
+        io_quit(&io);
+        free(ahead);
+        free(vm);
 
-    return EXIT_SUCCESS;
+        return err == E_OK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
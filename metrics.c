@@ -0,0 +1,252 @@
+#include "metrics.h"
+
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_PATH 1024
+
+void
+histogram_record(struct Histogram* histogram, uint64_t microseconds)
+{
+    size_t bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && microseconds > HISTOGRAM_BOUNDS_US[bucket])
+        bucket++;
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += microseconds;
+}
+
+static void
+reset_window(struct Metrics* metrics, uint64_t now)
+{
+    metrics->window_start = now;
+    metrics->window_instructions = 0;
+    metrics->window_presents = 0;
+    metrics->window_frame_us = 0;
+    metrics->window_frame_us_squared = 0;
+    metrics->window_display_us = 0;
+}
+
+void
+metrics_init(struct Metrics* metrics, unsigned int fps)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->frequency = SDL_GetPerformanceFrequency();
+    metrics->frame_ticks = metrics->frequency / fps;
+    reset_window(metrics, SDL_GetPerformanceCounter());
+}
+
+static uint64_t
+ticks_to_us(const struct Metrics* metrics, uint64_t ticks)
+{
+    return ticks * 1000000 / metrics->frequency;
+}
+
+//.. Count `frames` emulated since the last present, which executed
+//   `instructions` and took `ticks` of the performance counter
+void
+metrics_count_emulation(struct Metrics* metrics, unsigned long frames,
+                        uint64_t instructions, uint64_t ticks)
+{
+    metrics->frames_emulated += frames;
+    metrics->instructions += instructions;
+    metrics->window_instructions += instructions;
+    histogram_record(&metrics->emulation_time, ticks_to_us(metrics, ticks));
+}
+
+//.. Turn the sums of the current window into the rates shown on the HUD
+static void
+close_window(struct Metrics* metrics, uint64_t now)
+{
+    const double seconds = (double) (now - metrics->window_start) / metrics->frequency;
+    const unsigned long presents = metrics->window_presents;
+
+    metrics->fps = presents / seconds;
+    metrics->mips = metrics->window_instructions / seconds / 1e6;
+    if (presents > 0) {
+        const double mean = metrics->window_frame_us / presents;
+        const double variance = metrics->window_frame_us_squared / presents - mean * mean;
+        metrics->frame_ms = mean / 1000;
+        metrics->jitter_ms = variance > 0 ? sqrt(variance) / 1000 : 0;
+        metrics->display_ms = (double) metrics->window_display_us / presents / 1000;
+    }
+
+    reset_window(metrics, now);
+}
+
+//.. Count a present which spent `display_ticks` in io_update_display(), not
+//   counting the wait for the frame to be due. Only frames that were `paced`
+//   can be late, unpaced ones are presented as soon as they are ready.
+void
+metrics_count_present(struct Metrics* metrics, uint64_t display_ticks, bool paced)
+{
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const uint64_t display_us = ticks_to_us(metrics, display_ticks);
+
+    metrics->frames_presented++;
+    histogram_record(&metrics->display_time, display_us);
+    metrics->window_display_us += display_us;
+    metrics->window_presents++;
+
+    if (metrics->last_present != 0) {
+        const uint64_t elapsed = now - metrics->last_present;
+        const uint64_t frame_us = ticks_to_us(metrics, elapsed);
+        histogram_record(&metrics->frame_time, frame_us);
+        metrics->window_frame_us += frame_us;
+        metrics->window_frame_us_squared += (double) frame_us * frame_us;
+
+        //.. Rounded to whole frames, so that timer jitter isn't a drop
+        const uint64_t frames = (elapsed + metrics->frame_ticks / 2) / metrics->frame_ticks;
+        if (paced && frames > 1)
+            metrics->frames_dropped += frames - 1;
+    }
+    metrics->last_present = now;
+
+    if (now - metrics->window_start >= metrics->frequency * METRICS_WINDOW_MS / 1000)
+        close_window(metrics, now);
+}
+
+//.. The emulation was stopped, e.g. at the debugger prompt. The time until
+//   the next present is neither a frame time nor dropped frames.
+void
+metrics_resume(struct Metrics* metrics)
+{
+    metrics->last_present = 0;
+}
+
+static bool
+has_suffix(const char* string, const char* suffix)
+{
+    const size_t length = strlen(string);
+    const size_t suffix_length = strlen(suffix);
+    return length >= suffix_length &&
+           strcmp(string + length - suffix_length, suffix) == 0;
+}
+
+static void
+write_prometheus_histogram(FILE* file, const char* name, const char* help,
+                           const struct Histogram* histogram)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    //.. Prometheus buckets are cumulative
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+        cumulative += histogram->buckets[i];
+        fprintf(file, "%s_bucket{le=\"%g\"} %llu\n",
+            name, HISTOGRAM_BOUNDS_US[i] / 1e6, (unsigned long long) cumulative);
+    }
+    fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) histogram->count);
+    fprintf(file, "%s_sum %g\n", name, histogram->sum_us / 1e6);
+    fprintf(file, "%s_count %llu\n", name, (unsigned long long) histogram->count);
+}
+
+static void
+write_prometheus_value(FILE* file, const char* name, const char* type,
+                       const char* help, double value)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+}
+
+//.. Text exposition format, as read by e.g. node_exporter's textfile collector
+static void
+write_prometheus(FILE* file, const struct Metrics* metrics)
+{
+    write_prometheus_value(file, "chip8_instructions_total", "counter",
+        "Instructions emulated.", metrics->instructions);
+    write_prometheus_value(file, "chip8_frames_emulated_total", "counter",
+        "Frames emulated, including those skipped while fast-forwarding.",
+        metrics->frames_emulated);
+    write_prometheus_value(file, "chip8_frames_presented_total", "counter",
+        "Frames presented.", metrics->frames_presented);
+    write_prometheus_value(file, "chip8_frames_dropped_total", "counter",
+        "Display frames that passed without a present.", metrics->frames_dropped);
+    write_prometheus_value(file, "chip8_fps", "gauge",
+        "Presents per second.", metrics->fps);
+    write_prometheus_value(file, "chip8_emulated_mips", "gauge",
+        "Million instructions emulated per second.", metrics->mips);
+    write_prometheus_value(file, "chip8_frame_jitter_seconds", "gauge",
+        "Standard deviation of the time between presents.", metrics->jitter_ms / 1000);
+
+    write_prometheus_histogram(file, "chip8_frame_time_seconds",
+        "Time between presents.", &metrics->frame_time);
+    write_prometheus_histogram(file, "chip8_display_update_seconds",
+        "Time spent drawing and presenting a frame.", &metrics->display_time);
+    write_prometheus_histogram(file, "chip8_emulation_seconds",
+        "Time spent emulating the frames of one present.", &metrics->emulation_time);
+}
+
+static void
+write_json_histogram(FILE* file, const char* name, const struct Histogram* histogram,
+                     const char* separator)
+{
+    fprintf(file, "  \"%s\": {\"count\": %llu, \"sum_us\": %llu, \"buckets\": [",
+        name, (unsigned long long) histogram->count, (unsigned long long) histogram->sum_us);
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (i < HISTOGRAM_BUCKETS - 1)
+            fprintf(file, "{\"le_us\": %u, ", HISTOGRAM_BOUNDS_US[i]);
+        else
+            fprintf(file, "{\"le_us\": null, ");
+        fprintf(file, "\"count\": %llu}%s",
+            (unsigned long long) histogram->buckets[i], i < HISTOGRAM_BUCKETS - 1 ? ", " : "");
+    }
+    fprintf(file, "]}%s\n", separator);
+}
+
+static void
+write_json(FILE* file, const struct Metrics* metrics)
+{
+    fprintf(file,
+        "{\n"
+        "  \"instructions\": %llu,\n"
+        "  \"frames_emulated\": %llu,\n"
+        "  \"frames_presented\": %llu,\n"
+        "  \"frames_dropped\": %llu,\n"
+        "  \"fps\": %.3f,\n"
+        "  \"mips\": %.6f,\n"
+        "  \"frame_ms\": %.3f,\n"
+        "  \"jitter_ms\": %.3f,\n"
+        "  \"display_ms\": %.3f,\n",
+        (unsigned long long) metrics->instructions,
+        (unsigned long long) metrics->frames_emulated,
+        (unsigned long long) metrics->frames_presented,
+        (unsigned long long) metrics->frames_dropped,
+        metrics->fps, metrics->mips, metrics->frame_ms,
+        metrics->jitter_ms, metrics->display_ms
+    );
+    write_json_histogram(file, "frame_time", &metrics->frame_time, ",");
+    write_json_histogram(file, "display_time", &metrics->display_time, ",");
+    write_json_histogram(file, "emulation_time", &metrics->emulation_time, "");
+    fprintf(file, "}\n");
+}
+
+//.. Write the metrics to `path`, as JSON when it ends in .json and in the
+//   Prometheus text format otherwise. The file is written next to `path` and
+//   renamed over it, so readers never see a partial file.
+enum Error
+metrics_write(const struct Metrics* metrics, const char* path)
+{
+    char temporary_path[MAX_PATH];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= MAX_PATH)
+        return E_COULDNT_OPEN_FILE;
+
+    FILE* file = fopen(temporary_path, "w");
+    if (file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    if (has_suffix(path, ".json"))
+        write_json(file, metrics);
+    else
+        write_prometheus(file, metrics);
+
+    const bool written = !ferror(file);
+    if (fclose(file) != 0 || !written || rename(temporary_path, path) != 0) {
+        remove(temporary_path);
+        return E_COULDNT_WRITE_FILE;
+    }
+
+    return E_OK;
+}
@@ -0,0 +1,77 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "error.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Runtime metrics of the interactive frontend: counters and histograms that
+ * are cheap enough to always collect, a few samples per presented frame and
+ * nothing per instruction. They are shown on the HUD (see io.h) and written
+ * to a stats file with metrics_write().
+ */
+
+//.. Upper bounds of the histogram buckets in microseconds, an implicit last
+//   bucket holds everything above
+static const uint32_t HISTOGRAM_BOUNDS_US[] = {
+    100, 250, 500, 1000, 2000, 4000, 8000, 12000,
+    16000, 17000, 20000, 25000, 33000, 50000, 100000,
+};
+#define HISTOGRAM_BUCKETS \
+    (sizeof(HISTOGRAM_BOUNDS_US) / sizeof(HISTOGRAM_BOUNDS_US[0]) + 1)
+
+//.. Length of the window the rates shown on the HUD are averaged over
+#define METRICS_WINDOW_MS 500
+
+struct Histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS]; /* Not cumulative */
+    uint64_t count;
+    uint64_t sum_us;
+};
+
+struct Metrics {
+    uint64_t frequency;
+    uint64_t frame_ticks;
+
+    //.. Totals since start
+    uint64_t instructions;
+    uint64_t frames_emulated;
+    uint64_t frames_presented;
+    //.. Display frames that passed without a present while paced
+    uint64_t frames_dropped;
+
+    //.. Time between presents, spent in io_update_display() besides waiting
+    //   for the next frame, and spent emulating the frames of one present
+    struct Histogram frame_time;
+    struct Histogram display_time;
+    struct Histogram emulation_time;
+
+    uint64_t last_present;
+
+    //.. Sums over the current window
+    uint64_t window_start;
+    uint64_t window_instructions;
+    unsigned long window_presents;
+    double window_frame_us;
+    double window_frame_us_squared;
+    uint64_t window_display_us;
+
+    //.. Rates over the last complete window
+    double fps;
+    double mips;
+    double frame_ms;
+    double jitter_ms; /* Standard deviation of the frame time */
+    double display_ms;
+};
+
+void       histogram_record(struct Histogram*, uint64_t microseconds);
+
+void       metrics_init(struct Metrics*, unsigned int fps);
+void       metrics_count_emulation(struct Metrics*, unsigned long frames,
+                                   uint64_t instructions, uint64_t ticks);
+void       metrics_count_present(struct Metrics*, uint64_t display_ticks, bool paced);
+void       metrics_resume(struct Metrics*);
+enum Error metrics_write(const struct Metrics*, const char* path);
+
+#endif
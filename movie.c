@@ -0,0 +1,288 @@
+#include "movie.h"
+#include "hash.h"
+
+#include <string.h>
+
+static const char MAGIC[4] = { 'C', '8', 'M', 'V' };
+
+/* Encoding */
+
+static bool
+write_uint(FILE* file, uint64_t value, size_t size)
+{
+    uint8_t bytes[8];
+    for (size_t i = 0; i < size; i++)
+        bytes[i] = value >> (8 * i);
+
+    return fwrite(bytes, 1, size, file) == size;
+}
+
+static bool
+write_leb128(FILE* file, uint64_t value)
+{
+    do {
+        const uint8_t byte = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+        if (fputc(byte, file) == EOF)
+            return false;
+        value >>= 7;
+    } while (value != 0);
+
+    return true;
+}
+
+static bool
+read_uint(FILE* file, uint64_t* value, size_t size)
+{
+    uint8_t bytes[8];
+    if (fread(bytes, 1, size, file) != size)
+        return false;
+
+    *value = 0;
+    for (size_t i = 0; i < size; i++)
+        *value |= (uint64_t) bytes[i] << (8 * i);
+
+    return true;
+}
+
+static bool
+read_leb128(FILE* file, uint64_t* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int byte = fgetc(file);
+        if (byte == EOF)
+            return false;
+
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+/* Recording */
+
+//.. Start recording a session of `vm`, which must be in its power-on state
+//   with the ROM loaded.
+enum Error
+movie_record(struct Movie* movie, const char* path, const struct VM* vm)
+{
+    *movie = (struct Movie) {
+        .recording = true,
+        .rom_hash = vm->rom_hash,
+        .random_seed = vm->random_state,
+        .quirks = vm->quirks,
+        .keypad = 0,
+        .run_length = 0,
+    };
+
+    movie->file = fopen(path, "wb");
+    if (movie->file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    if (fwrite(MAGIC, 1, sizeof(MAGIC), movie->file) != sizeof(MAGIC) ||
+        !write_uint(movie->file, MOVIE_VERSION, 2) ||
+        !write_uint(movie->file, movie->rom_hash, 8) ||
+        !write_uint(movie->file, movie->random_seed, 4) ||
+        !write_uint(movie->file, movie->quirks, 1)
+    ) {
+        fclose(movie->file);
+        return E_COULDNT_WRITE_FILE;
+    }
+
+    return E_OK;
+}
+
+static bool
+flush_run(struct Movie* movie)
+{
+    if (movie->run_length == 0)
+        return true;
+
+    const bool written = fputc(MOVIE_RECORD_KEYS, movie->file) != EOF &&
+                         write_uint(movie->file, movie->keypad, 2) &&
+                         write_leb128(movie->file, movie->run_length);
+    movie->run_length = 0;
+    return written;
+}
+
+//.. Record that the frame `vm` just ran was emulated with `keypad`
+enum Error
+movie_record_frame(struct Movie* movie, const struct VM* vm, uint16_t keypad)
+{
+    if (keypad != movie->keypad && !flush_run(movie))
+        return E_COULDNT_WRITE_FILE;
+
+    movie->keypad = keypad;
+    movie->run_length++;
+
+    if (vm->frame_count % MOVIE_CHECKPOINT_INTERVAL == 0) {
+        if (!flush_run(movie) ||
+            fputc(MOVIE_RECORD_CHECKPOINT, movie->file) == EOF ||
+            !write_leb128(movie->file, vm->frame_count) ||
+            !write_uint(movie->file, vm_state_hash(vm), 8)
+        ) {
+            return E_COULDNT_WRITE_FILE;
+        }
+    }
+
+    return E_OK;
+}
+
+/* Playback */
+
+static bool
+read_header(FILE* file, uint64_t* rom_hash, uint64_t* random_seed, uint64_t* quirks)
+{
+    char magic[sizeof(MAGIC)];
+    uint64_t version;
+    return fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+           memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 &&
+           read_uint(file, &version, 2) &&
+           version == MOVIE_VERSION &&
+           read_uint(file, rom_hash, 8) &&
+           read_uint(file, random_seed, 4) &&
+           read_uint(file, quirks, 1) &&
+           *quirks <= QUIRKS_XOCHIP;
+}
+
+//.. Quirk profile a movie was recorded with, which the machine playing it
+//   has to be created with
+enum Error
+movie_profile(const char* path, enum QuirkProfile* profile)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    uint64_t rom_hash, random_seed, quirks;
+    const bool valid = read_header(file, &rom_hash, &random_seed, &quirks);
+    fclose(file);
+    if (!valid)
+        return E_INVALID_MOVIE;
+
+    *profile = quirks;
+    return E_OK;
+}
+
+//.. Open a movie and put `vm`, which has the ROM loaded and the movie's
+//   profile (see movie_profile()), in the state the recording started from.
+enum Error
+movie_play(struct Movie* movie, const char* path, struct VM* vm)
+{
+    *movie = (struct Movie) { .recording = false };
+
+    movie->file = fopen(path, "rb");
+    if (movie->file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    uint64_t rom_hash, random_seed, quirks;
+    if (!read_header(movie->file, &rom_hash, &random_seed, &quirks)) {
+        fclose(movie->file);
+        return E_INVALID_MOVIE;
+    }
+
+    movie->rom_hash = rom_hash;
+    movie->random_seed = random_seed;
+    movie->quirks = quirks;
+
+    if (rom_hash != vm->rom_hash) {
+        fclose(movie->file);
+        return E_MOVIE_ROM_MISMATCH;
+    }
+    if (quirks != vm->quirks) {
+        fclose(movie->file);
+        return E_MOVIE_PROFILE_MISMATCH;
+    }
+
+    vm->random_state = random_seed;
+
+    //.. Read up to the first run of keys
+    enum Error err = movie_verify(movie, vm);
+    if (err != E_OK)
+        fclose(movie->file);
+
+    return err;
+}
+
+//.. Keypad state for the next frame. Returns false at the end of the movie.
+bool
+movie_next_keypad(struct Movie* movie, uint16_t* keypad)
+{
+    if (movie->run_length == 0)
+        return false;
+
+    movie->run_length--;
+    *keypad = movie->keypad;
+    return true;
+}
+
+//.. Check `vm` against the checkpoints recorded after its current frame and
+//   read ahead to the next run of keys.
+enum Error
+movie_verify(struct Movie* movie, const struct VM* vm)
+{
+    while (movie->run_length == 0 && !movie->ended) {
+        uint64_t value, hash;
+
+        switch (fgetc(movie->file)) {
+        case MOVIE_RECORD_KEYS:
+            if (!read_uint(movie->file, &value, 2))
+                return E_INVALID_MOVIE;
+            movie->keypad = value;
+            if (!read_leb128(movie->file, &value))
+                return E_INVALID_MOVIE;
+            movie->run_length = value;
+            break;
+        case MOVIE_RECORD_CHECKPOINT:
+            if (!read_leb128(movie->file, &value) || !read_uint(movie->file, &hash, 8))
+                return E_INVALID_MOVIE;
+            if (value != vm->frame_count || hash != vm_state_hash(vm))
+                return E_MOVIE_DESYNC;
+            break;
+        case MOVIE_RECORD_END:
+            movie->ended = true;
+            break;
+        default:
+            return E_INVALID_MOVIE;
+        }
+    }
+
+    return E_OK;
+}
+
+//.. Replay headless as fast as possible until `frame`, or the end of the
+//   movie when `frame` is 0 or lies beyond it.
+enum Error
+movie_play_until(struct Movie* movie, struct VM* vm, unsigned long frame)
+{
+    while (frame == 0 || vm->frame_count < frame) {
+        if (!movie_next_keypad(movie, &vm->keypad))
+            break;
+
+        enum Error err = vm_run_frame(vm);
+        if (err == E_OK)
+            err = movie_verify(movie, vm);
+        if (err != E_OK)
+            return err;
+    }
+
+    return E_OK;
+}
+
+enum Error
+movie_close(struct Movie* movie)
+{
+    enum Error err = E_OK;
+
+    if (movie->recording) {
+        if (!flush_run(movie) || fputc(MOVIE_RECORD_END, movie->file) == EOF)
+            err = E_COULDNT_WRITE_FILE;
+    }
+
+    if (fclose(movie->file) != 0 && movie->recording)
+        err = E_COULDNT_WRITE_FILE;
+
+    return err;
+}
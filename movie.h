@@ -0,0 +1,61 @@
+#ifndef MOVIE_H_
+#define MOVIE_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Input movies
+ *
+ * A movie holds everything needed to replay a session exactly: the hash of
+ * the ROM, the quirk profile, the seed of the random number generator and the
+ * keypad state of every frame. Recording always starts at power-on.
+ *
+ * File layout, all integers little-endian:
+ * - "C8MV", 16-bit version, 64-bit ROM hash, 32-bit seed, 8-bit quirk profile;
+ * - records, each starting with a tag byte:
+ *   - MOVIE_RECORD_KEYS: 16-bit keypad, then the number of frames it was held
+ *     as an unsigned LEB128 value;
+ *   - MOVIE_RECORD_CHECKPOINT: frame number as LEB128, then the 64-bit
+ *     vm_state_hash() after that frame. Written every
+ *     MOVIE_CHECKPOINT_INTERVAL frames, so a desync is caught within a second;
+ *   - MOVIE_RECORD_END.
+ */
+
+#define MOVIE_VERSION             2
+#define MOVIE_CHECKPOINT_INTERVAL 60
+
+enum MovieRecord {
+    MOVIE_RECORD_END = 0,
+    MOVIE_RECORD_KEYS,
+    MOVIE_RECORD_CHECKPOINT,
+};
+
+struct Movie {
+    FILE* file;
+    bool recording;
+
+    uint64_t rom_hash;
+    uint32_t random_seed;
+    uint8_t quirks;
+
+    //.. Keypad state of the current run and the frames left in it (playback)
+    //   or recorded so far (recording).
+    uint16_t keypad;
+    unsigned long run_length;
+    bool ended;
+};
+
+enum Error movie_record(struct Movie*, const char* path, const struct VM*);
+enum Error movie_record_frame(struct Movie*, const struct VM*, uint16_t keypad);
+enum Error movie_profile(const char* path, enum QuirkProfile*);
+enum Error movie_play(struct Movie*, const char* path, struct VM*);
+bool       movie_next_keypad(struct Movie*, uint16_t* keypad);
+enum Error movie_verify(struct Movie*, const struct VM*);
+enum Error movie_play_until(struct Movie*, struct VM*, unsigned long frame);
+enum Error movie_close(struct Movie*);
+
+#endif
@@ -0,0 +1,137 @@
+#include "pacing.h"
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+//.. Below this many milliseconds of remaining time we busy-wait instead of
+//   sleeping, as SDL_Delay() is only accurate to a few milliseconds.
+#define SPIN_THRESHOLD_MS 2
+
+void
+pacer_init(struct Pacer* pacer, unsigned int fps, bool vsync)
+{
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+
+    *pacer = (struct Pacer) {
+        .frequency = frequency,
+        .frame_ticks = frequency / fps,
+        .frame_remainder = frequency % fps,
+        .remainder_accumulator = 0,
+        .fps = fps,
+        .next_deadline = SDL_GetPerformanceCounter(),
+        .last_present = 0,
+        .vsync = vsync,
+        .samples = {0},
+        .sample_count = 0,
+    };
+}
+
+static void
+advance_deadline(struct Pacer* pacer)
+{
+    pacer->next_deadline += pacer->frame_ticks;
+
+    pacer->remainder_accumulator += pacer->frame_remainder;
+    if (pacer->remainder_accumulator >= pacer->fps) {
+        pacer->remainder_accumulator -= pacer->fps;
+        pacer->next_deadline++;
+    }
+}
+
+//.. Block until the next frame is due. With vsync enabled the final wait is
+//   left to SDL_RenderPresent(), which returns on the next vertical blank.
+void
+pacer_wait(struct Pacer* pacer)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (now > pacer->next_deadline + PACER_MAX_LAG_FRAMES * pacer->frame_ticks)
+        pacer->next_deadline = now;
+
+    const uint64_t ticks_per_ms = pacer->frequency / 1000;
+    const uint64_t vsync_slack = pacer->vsync ? SPIN_THRESHOLD_MS * ticks_per_ms : 0;
+
+    while (now + vsync_slack < pacer->next_deadline) {
+        const uint64_t remaining_ms = (pacer->next_deadline - now) / ticks_per_ms;
+        if (remaining_ms > SPIN_THRESHOLD_MS)
+            SDL_Delay(remaining_ms - SPIN_THRESHOLD_MS);
+
+        now = SDL_GetPerformanceCounter();
+    }
+
+    advance_deadline(pacer);
+}
+
+//.. Start the schedule over from now, e.g. after presenting unpaced frames
+void
+pacer_restart(struct Pacer* pacer)
+{
+    pacer->next_deadline = SDL_GetPerformanceCounter();
+    pacer->remainder_accumulator = 0;
+}
+
+void
+pacer_mark_present(struct Pacer* pacer)
+{
+    const uint64_t now = SDL_GetPerformanceCounter();
+
+    if (pacer->last_present != 0) {
+        const uint64_t elapsed_us =
+            (now - pacer->last_present) * 1000000 / pacer->frequency;
+        pacer->samples[pacer->sample_count++ % PACER_SAMPLES] =
+            elapsed_us > UINT32_MAX ? UINT32_MAX : elapsed_us;
+    }
+
+    pacer->last_present = now;
+}
+
+static int
+compare_samples(const void* a, const void* b)
+{
+    const uint32_t lhs = *(const uint32_t*) a;
+    const uint32_t rhs = *(const uint32_t*) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+//.. Frame time in milliseconds below which `percentile` percent of the most
+//   recent PACER_SAMPLES frames fall. Returns 0 when nothing was presented yet.
+double
+pacer_percentile(const struct Pacer* pacer, double percentile)
+{
+    const size_t count = pacer->sample_count < PACER_SAMPLES
+        ? pacer->sample_count
+        : PACER_SAMPLES;
+    if (count == 0)
+        return 0;
+
+    uint32_t sorted[PACER_SAMPLES];
+    memcpy(sorted, pacer->samples, count * sizeof(uint32_t));
+    qsort(sorted, count, sizeof(uint32_t), compare_samples);
+
+    size_t index = (size_t) (percentile / 100.0 * count);
+    if (index >= count)
+        index = count - 1;
+
+    return sorted[index] / 1000.0;
+}
+
+void
+pacer_report(const struct Pacer* pacer, FILE* out)
+{
+    const unsigned long window = pacer->sample_count < PACER_SAMPLES
+        ? pacer->sample_count
+        : PACER_SAMPLES;
+
+    fprintf(
+        out,
+        "Frame times over the last %lu frames (%s): "
+        "p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+        window,
+        pacer->vsync ? "vsync" : "no vsync",
+        pacer_percentile(pacer, 50),
+        pacer_percentile(pacer, 90),
+        pacer_percentile(pacer, 99),
+        pacer_percentile(pacer, 100)
+    );
+}
@@ -0,0 +1,39 @@
+#ifndef PACING_H_
+#define PACING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//.. Amount of frame times kept for the percentile report
+#define PACER_SAMPLES 1024
+
+//.. When the emulator falls this many frames behind schedule, the schedule is
+//   restarted instead of rushing through the missed frames.
+#define PACER_MAX_LAG_FRAMES 4
+
+struct Pacer {
+    uint64_t frequency;
+    uint64_t frame_ticks;
+    //.. Fractional part of a frame in 1/fps ticks, carried over between frames
+    //   so that the average frame length is exactly 1/fps of a second.
+    uint64_t frame_remainder;
+    uint64_t remainder_accumulator;
+    unsigned int fps;
+
+    uint64_t next_deadline;
+    uint64_t last_present;
+    bool vsync;
+
+    uint32_t samples[PACER_SAMPLES]; /* Frame times in microseconds */
+    unsigned long sample_count;
+};
+
+void   pacer_init(struct Pacer*, unsigned int fps, bool vsync);
+void   pacer_wait(struct Pacer*);
+void   pacer_restart(struct Pacer*);
+void   pacer_mark_present(struct Pacer*);
+double pacer_percentile(const struct Pacer*, double percentile);
+void   pacer_report(const struct Pacer*, FILE*);
+
+#endif
@@ -0,0 +1,141 @@
+#include "png.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Minimal PNG encoder for 8-bit grayscale images. The image data is stored in
+ * uncompressed deflate blocks, which keeps the encoder small; the images are
+ * only written for inspecting regressions.
+ */
+
+//.. Largest amount of data in a single stored deflate block
+#define STORED_BLOCK_MAX 0xFFFF
+
+static uint32_t
+crc32_update(uint32_t crc, const uint8_t* bytes, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+static void
+put_u32(uint8_t* out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static bool
+write_chunk(FILE* file, const char type[4], const uint8_t* data, size_t length)
+{
+    uint8_t header[8];
+    put_u32(header, length);
+    memcpy(&header[4], type, 4);
+
+    uint32_t crc = crc32_update(0, (const uint8_t*) type, 4);
+    crc = crc32_update(crc, data, length);
+    uint8_t footer[4];
+    put_u32(footer, crc);
+
+    return fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+           (length == 0 || fwrite(data, 1, length, file) == length) &&
+           fwrite(footer, 1, sizeof(footer), file) == sizeof(footer);
+}
+
+//.. Gray levels of the combinations of lit bitplanes, see vm_pixel()
+static const uint8_t PLANE_GRAYS[1 << DISPLAY_PLANES] = {0x00, 0xFF, 0xAA, 0x55};
+
+enum Error
+png_write_display(const char* path, const struct VM* vm, unsigned int scale)
+{
+    const uint32_t width = vm_display_width(vm) * scale;
+    const uint32_t height = vm_display_height(vm) * scale;
+
+    //.. Every scanline starts with filter type 0 (none)
+    const size_t raw_length = (size_t) height * (1 + width);
+    const size_t block_count = (raw_length + STORED_BLOCK_MAX - 1) / STORED_BLOCK_MAX;
+    const size_t zlib_length = 2 + block_count * 5 + raw_length + 4;
+
+    uint8_t* raw = malloc(raw_length);
+    uint8_t* zlib = malloc(zlib_length);
+    if (raw == NULL || zlib == NULL) {
+        free(raw);
+        free(zlib);
+        return E_OUT_OF_MEMORY;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t* scanline = &raw[y * (1 + width)];
+        scanline[0] = 0;
+        for (uint32_t x = 0; x < width; x++)
+            scanline[1 + x] = PLANE_GRAYS[vm_pixel(vm, y / scale, x / scale)];
+    }
+
+    //.. zlib header: deflate with a 32K window, no preset dictionary
+    size_t length = 0;
+    zlib[length++] = 0x78;
+    zlib[length++] = 0x01;
+
+    uint32_t adler_a = 1, adler_b = 0;
+    for (size_t offset = 0; offset < raw_length; offset += STORED_BLOCK_MAX) {
+        const size_t block_length = raw_length - offset < STORED_BLOCK_MAX
+            ? raw_length - offset
+            : STORED_BLOCK_MAX;
+        const bool final_block = offset + block_length == raw_length;
+
+        zlib[length++] = final_block;
+        zlib[length++] = block_length & 0xFF;
+        zlib[length++] = block_length >> 8;
+        zlib[length++] = ~block_length & 0xFF;
+        zlib[length++] = (~block_length >> 8) & 0xFF;
+        memcpy(&zlib[length], &raw[offset], block_length);
+        length += block_length;
+
+        for (size_t i = 0; i < block_length; i++) {
+            adler_a = (adler_a + raw[offset + i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+    put_u32(&zlib[length], (adler_b << 16) | adler_a);
+    length += 4;
+
+    uint8_t header[13];
+    put_u32(&header[0], width);
+    put_u32(&header[4], height);
+    header[8] = 8;  /* Bit depth */
+    header[9] = 0;  /* Grayscale */
+    header[10] = 0; /* Deflate */
+    header[11] = 0; /* Adaptive filtering */
+    header[12] = 0; /* No interlacing */
+
+    static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    enum Error err = E_OK;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        err = E_COULDNT_OPEN_FILE;
+    } else {
+        if (fwrite(SIGNATURE, 1, sizeof(SIGNATURE), file) != sizeof(SIGNATURE) ||
+            !write_chunk(file, "IHDR", header, sizeof(header)) ||
+            !write_chunk(file, "IDAT", zlib, length) ||
+            !write_chunk(file, "IEND", NULL, 0)
+        ) {
+            err = E_COULDNT_WRITE_FILE;
+        }
+        fclose(file);
+    }
+
+    free(raw);
+    free(zlib);
+    return err;
+}
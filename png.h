@@ -0,0 +1,11 @@
+#ifndef PNG_H_
+#define PNG_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+
+enum Error png_write_display(const char* path, const struct VM*, unsigned int scale);
+
+#endif
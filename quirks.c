@@ -0,0 +1,64 @@
+#include "quirks.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* PROFILE_NAMES[] = {
+    [QUIRKS_MODERN] = "modern",
+    [QUIRKS_VIP] = "vip",
+    [QUIRKS_SCHIP] = "schip",
+    [QUIRKS_XOCHIP] = "xochip",
+};
+#define PROFILE_COUNT (sizeof(PROFILE_NAMES) / sizeof(PROFILE_NAMES[0]))
+
+bool
+quirks_from_name(const char* name, enum QuirkProfile* profile)
+{
+    for (size_t i = 0; i < PROFILE_COUNT; i++) {
+        if (strcmp(name, PROFILE_NAMES[i]) == 0) {
+            *profile = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char*
+quirks_name(enum QuirkProfile profile)
+{
+    assert(profile < PROFILE_COUNT);
+    return PROFILE_NAMES[profile];
+}
+
+enum Error
+quirks_lookup(const char* database_path, uint64_t rom_hash,
+              enum QuirkProfile* profile, bool* found)
+{
+    FILE* file = fopen(database_path, "r");
+    if (file == NULL)
+        return E_COULDNT_OPEN_FILE;
+
+    *found = false;
+
+    char line[256];
+    while (!*found && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        uint64_t hash;
+        char name[32];
+        if (sscanf(line, "%" SCNx64 " %31s", &hash, name) != 2 ||
+            !quirks_from_name(name, profile)
+        ) {
+            fclose(file);
+            return E_INVALID_QUIRK_DATABASE;
+        }
+
+        *found = hash == rom_hash;
+    }
+
+    fclose(file);
+    return E_OK;
+}
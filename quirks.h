@@ -0,0 +1,25 @@
+#ifndef QUIRKS_H_
+#define QUIRKS_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Quirk profile database
+ *
+ * A text file in which every line holds the hash of a ROM, as computed by
+ * vm_insert_rom(), in hexadecimal followed by the name of a profile:
+ *
+ *     # Comments start with a hash sign
+ *     9f1c4e1ba7b3f0c2 vip
+ *     0d4a6e2c31f09b57 schip
+ */
+
+bool        quirks_from_name(const char* name, enum QuirkProfile* profile);
+const char* quirks_name(enum QuirkProfile);
+enum Error  quirks_lookup(const char* database_path, uint64_t rom_hash,
+                          enum QuirkProfile* profile, bool* found);
+
+#endif
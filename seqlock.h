@@ -0,0 +1,43 @@
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Single-writer sequence lock. The sequence is odd while the writer is
+ * updating the protected data; readers copy the data and retry when the
+ * sequence was odd or changed in the meantime, so the writer never waits.
+ */
+
+static inline void
+seqlock_write_begin(uint32_t* sequence)
+{
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+seqlock_write_end(uint32_t* sequence)
+{
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE);
+}
+
+//.. Spins while a write is in progress
+static inline uint32_t
+seqlock_read_begin(const uint32_t* sequence)
+{
+    uint32_t value;
+    while ((value = __atomic_load_n(sequence, __ATOMIC_ACQUIRE)) & 1)
+        ;
+
+    return value;
+}
+
+static inline bool
+seqlock_read_retry(const uint32_t* sequence, uint32_t begin)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(sequence, __ATOMIC_RELAXED) != begin;
+}
+
+#endif
@@ -0,0 +1,426 @@
+#define _DEFAULT_SOURCE
+
+#include "server.h"
+#include "seqlock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//.. How long the server thread waits for socket activity before checking for
+//   a new frame, in milliseconds.
+#define POLL_INTERVAL_MS 4
+
+#define ROW_MESSAGE_SIZE   (1 + 1 + 8)
+#define WIDE_ROW_MESSAGE_SIZE (1 + 1 + 8 * DISPLAY_WORDS)
+#define STATE_MESSAGE_SIZE (1 + REGISTERS_SIZE + 2 + 2 + 1 + 1 + 1)
+
+static uint32_t
+load_acquire(const uint32_t* value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void
+store_release(uint32_t* value, uint32_t new_value)
+{
+    __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+/* Command queue */
+
+static bool
+queue_push(struct Server* server, const struct ServerCommand* command)
+{
+    const uint32_t head = server->queue_head;
+    if (head - load_acquire(&server->queue_tail) == SERVER_QUEUE_SIZE)
+        return false;
+
+    server->queue[head & (SERVER_QUEUE_SIZE - 1)] = *command;
+    store_release(&server->queue_head, head + 1);
+    return true;
+}
+
+static bool
+queue_pop(struct Server* server, struct ServerCommand* command)
+{
+    const uint32_t tail = server->queue_tail;
+    if (tail == load_acquire(&server->queue_head))
+        return false;
+
+    *command = server->queue[tail & (SERVER_QUEUE_SIZE - 1)];
+    store_release(&server->queue_tail, tail + 1);
+    return true;
+}
+
+/* Frame seqlock */
+
+static void
+write_frame(struct Server* server, const struct ServerFrame* frame)
+{
+    seqlock_write_begin(&server->frame_sequence);
+    server->frame = *frame;
+    seqlock_write_end(&server->frame_sequence);
+}
+
+//.. Returns the sequence number of the copied frame
+static uint32_t
+read_frame(struct Server* server, struct ServerFrame* frame)
+{
+    uint32_t sequence;
+    do {
+        sequence = seqlock_read_begin(&server->frame_sequence);
+        *frame = server->frame;
+    } while (seqlock_read_retry(&server->frame_sequence, sequence));
+
+    return sequence;
+}
+
+/* Server thread */
+
+static void
+disconnect_client(struct ServerClient* client)
+{
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void
+accept_client(struct Server* server)
+{
+    const int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        struct ServerClient* client = &server->clients[i];
+        if (client->fd < 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            *client = (struct ServerClient) { .fd = fd };
+            return;
+        }
+    }
+
+    //.. No free slot
+    close(fd);
+}
+
+//.. Size of the command at the start of the client's input, or 0 if it has
+//   not been received completely yet.
+static size_t
+command_size(const struct ServerClient* client)
+{
+    switch (client->input[0]) {
+    case SERVER_CMD_KEY_DOWN:
+    case SERVER_CMD_KEY_UP:
+        return client->input_length >= 2 ? 2 : 0;
+    case SERVER_CMD_LOAD_ROM: {
+        if (client->input_length < 3)
+            return 0;
+        const size_t path_length = (client->input[1] << 8) | client->input[2];
+        return client->input_length >= 3 + path_length ? 3 + path_length : 0;
+    }
+    default:
+        return 1;
+    }
+}
+
+//.. Returns false when the client sent something invalid
+static bool
+parse_command(struct Server* server, struct ServerClient* client, size_t size)
+{
+    struct ServerCommand command = { .type = client->input[0] };
+
+    switch (command.type) {
+    case SERVER_CMD_KEY_DOWN:
+    case SERVER_CMD_KEY_UP:
+        if (client->input[1] > 0xF)
+            return false;
+        command.key = client->input[1];
+        break;
+    case SERVER_CMD_LOAD_ROM:
+        if (size - 3 >= SERVER_MAX_PATH)
+            return false;
+        memcpy(command.path, &client->input[3], size - 3);
+        command.path[size - 3] = '\0';
+        break;
+    case SERVER_CMD_SNAPSHOT:
+        client->wants_snapshot = true;
+        break;
+    case SERVER_CMD_PAUSE:
+    case SERVER_CMD_RESUME:
+    case SERVER_CMD_STEP:
+        break;
+    default:
+        return false;
+    }
+
+    //.. A full queue means the emulation thread is stalled, drop the command
+    //   rather than stalling the server thread as well.
+    queue_push(server, &command);
+    return true;
+}
+
+static void
+read_client(struct Server* server, struct ServerClient* client)
+{
+    const ssize_t received = recv(
+        client->fd,
+        &client->input[client->input_length],
+        sizeof(client->input) - client->input_length,
+        0
+    );
+    if (received <= 0) {
+        if (received == 0 || (errno != EAGAIN && errno != EINTR))
+            disconnect_client(client);
+        return;
+    }
+    client->input_length += received;
+
+    size_t size;
+    while (client->input_length > 0 && (size = command_size(client)) > 0) {
+        if (size > sizeof(client->input) || !parse_command(server, client, size)) {
+            disconnect_client(client);
+            return;
+        }
+
+        client->input_length -= size;
+        memmove(client->input, &client->input[size], client->input_length);
+    }
+
+    if (client->input_length == sizeof(client->input))
+        disconnect_client(client);
+}
+
+static void
+put_u16(uint8_t* out, uint16_t value)
+{
+    out[0] = value >> 8;
+    out[1] = value & 0xFF;
+}
+
+//.. Push changed rows, and the state if a snapshot was requested, to a client.
+//   Clients that can't keep up are disconnected.
+static void
+send_frame(struct ServerClient* client, const struct ServerFrame* frame, bool snapshot)
+{
+    uint8_t buffer[DISPLAY_MAX_HEIGHT * WIDE_ROW_MESSAGE_SIZE + STATE_MESSAGE_SIZE];
+    size_t length = 0;
+
+    const bool send_all_rows = !client->synced || snapshot || frame->hires != client->sent_hires;
+    const int height = frame->hires ? DISPLAY_MAX_HEIGHT : DISPLAY_HEIGHT;
+    const int words = frame->hires ? DISPLAY_WORDS : 1;
+    for (int row = 0; row < height; row++) {
+        if (!send_all_rows &&
+            memcmp(frame->rows[row], client->sent_rows[row], words * sizeof(uint64_t)) == 0
+        )
+            continue;
+
+        uint8_t* message = &buffer[length];
+        message[0] = frame->hires ? SERVER_MSG_WIDE_ROW : SERVER_MSG_ROW;
+        message[1] = row;
+        for (int word = 0; word < words; word++) {
+            for (int byte = 0; byte < 8; byte++)
+                message[2 + 8 * word + byte] = frame->rows[row][word] >> (56 - 8 * byte);
+        }
+
+        length += frame->hires ? WIDE_ROW_MESSAGE_SIZE : ROW_MESSAGE_SIZE;
+        memcpy(client->sent_rows[row], frame->rows[row], sizeof(frame->rows[row]));
+    }
+    client->sent_hires = frame->hires;
+    client->synced = true;
+
+    if (snapshot) {
+        uint8_t* message = &buffer[length];
+        message[0] = SERVER_MSG_STATE;
+        memcpy(&message[1], frame->data_registers, REGISTERS_SIZE);
+        put_u16(&message[1 + REGISTERS_SIZE], frame->address_register);
+        put_u16(&message[3 + REGISTERS_SIZE], frame->program_counter);
+        message[5 + REGISTERS_SIZE] = frame->stack_length;
+        message[6 + REGISTERS_SIZE] = frame->delay_timer;
+        message[7 + REGISTERS_SIZE] = frame->sound_timer;
+        length += STATE_MESSAGE_SIZE;
+    }
+
+    if (length == 0)
+        return;
+
+    if (send(client->fd, buffer, length, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t) length)
+        disconnect_client(client);
+}
+
+static void*
+server_thread(void* argument)
+{
+    struct Server* server = argument;
+    uint32_t sent_sequence = 0;
+
+    while (__atomic_load_n(&server->running, __ATOMIC_ACQUIRE)) {
+        struct pollfd fds[1 + SERVER_MAX_CLIENTS];
+        fds[0] = (struct pollfd) { .fd = server->listen_fd, .events = POLLIN };
+        for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++)
+            fds[1 + i] = (struct pollfd) { .fd = server->clients[i].fd, .events = POLLIN };
+
+        if (poll(fds, 1 + SERVER_MAX_CLIENTS, POLL_INTERVAL_MS) > 0) {
+            if (fds[0].revents & POLLIN)
+                accept_client(server);
+
+            for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+                if (server->clients[i].fd >= 0 && fds[1 + i].revents)
+                    read_client(server, &server->clients[i]);
+            }
+        }
+
+        struct ServerFrame frame;
+        const uint32_t sequence = read_frame(server, &frame);
+        const bool snapshot_ready = frame.snapshot_serial != server->snapshot_serial_sent;
+
+        for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            struct ServerClient* client = &server->clients[i];
+            if (client->fd < 0)
+                continue;
+
+            const bool snapshot = snapshot_ready && client->wants_snapshot;
+            if (sequence != sent_sequence || !client->synced || snapshot)
+                send_frame(client, &frame, snapshot);
+            if (snapshot)
+                client->wants_snapshot = false;
+        }
+
+        sent_sequence = sequence;
+        server->snapshot_serial_sent = frame.snapshot_serial;
+    }
+
+    return NULL;
+}
+
+/* Emulation thread */
+
+enum Error
+server_start(struct Server* server, const char* socket_path)
+{
+    *server = (struct Server) { .listen_fd = -1, .running = true };
+    for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++)
+        server->clients[i].fd = -1;
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path) ||
+        strlen(socket_path) >= sizeof(server->socket_path)
+    ) {
+        return E_SOCKET_ERROR;
+    }
+    strcpy(address.sun_path, socket_path);
+    strcpy(server->socket_path, socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (server->listen_fd < 0)
+        return E_SOCKET_ERROR;
+
+    //.. Remove a socket left behind by an earlier instance, but never any
+    //   other kind of file
+    struct stat status;
+    if (lstat(socket_path, &status) == 0 && S_ISSOCK(status.st_mode))
+        unlink(socket_path);
+
+    if (bind(server->listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+        goto error;
+
+    //.. From here on the socket file is ours to remove
+    if (listen(server->listen_fd, SERVER_MAX_CLIENTS) != 0 ||
+        pthread_create(&server->thread, NULL, server_thread, server) != 0
+    ) {
+        goto error_bound;
+    }
+
+    return E_OK;
+
+    error_bound:
+        unlink(socket_path);
+    error:
+        close(server->listen_fd);
+        return E_SOCKET_ERROR;
+}
+
+//.. Apply the commands clients sent since the last call. While paused, the
+//   frontend only executes `pending_steps` single instructions.
+void
+server_process_commands(struct Server* server, struct VM* vm)
+{
+    struct ServerCommand command;
+    while (queue_pop(server, &command)) {
+        switch (command.type) {
+        case SERVER_CMD_KEY_DOWN:
+            server->held_keys |= 1 << command.key;
+            break;
+        case SERVER_CMD_KEY_UP:
+            server->held_keys &= ~(1 << command.key);
+            break;
+        case SERVER_CMD_PAUSE:
+            server->paused = true;
+            server->pending_steps = 0;
+            break;
+        case SERVER_CMD_RESUME:
+            server->paused = false;
+            break;
+        case SERVER_CMD_STEP:
+            server->pending_steps++;
+            break;
+        case SERVER_CMD_SNAPSHOT:
+            server->snapshot_serial++;
+            server_publish(server, vm);
+            break;
+        case SERVER_CMD_LOAD_ROM: {
+            vm_reset(vm);
+            enum Error err = vm_insert_rom(vm, command.path);
+            if (err != E_OK)
+                fprintf(stderr, "Error: %s: %s\n", command.path, error_to_str(err));
+            server_publish(server, vm);
+            break;
+        }
+        }
+    }
+}
+
+//.. Make the current frame and registers available to the server thread
+void
+server_publish(struct Server* server, const struct VM* vm)
+{
+    struct ServerFrame frame = {
+        .address_register = vm->address_register,
+        .program_counter = vm->program_counter,
+        .stack_length = vm->stack.length,
+        .delay_timer = vm->delay_timer,
+        .sound_timer = vm->sound_timer,
+        .snapshot_serial = server->snapshot_serial,
+    };
+    memcpy(frame.data_registers, vm->data_registers, REGISTERS_SIZE);
+
+    frame.hires = vm->hires;
+    for (int row = 0; row < DISPLAY_MAX_HEIGHT; row++) {
+        for (int word = 0; word < DISPLAY_WORDS; word++)
+            frame.rows[row][word] = vm->display[0][row][word] | vm->display[1][row][word];
+    }
+
+    write_frame(server, &frame);
+}
+
+void
+server_stop(struct Server* server)
+{
+    __atomic_store_n(&server->running, false, __ATOMIC_RELEASE);
+    pthread_join(server->thread, NULL);
+
+    for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0)
+            disconnect_client(&server->clients[i]);
+    }
+
+    close(server->listen_fd);
+    unlink(server->socket_path);
+}
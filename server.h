@@ -0,0 +1,116 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "error.h"
+#include "vm.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Control-and-stream server on a Unix domain socket.
+ *
+ * Clients send commands, each being a single command byte optionally followed
+ * by a payload:
+ * - SERVER_CMD_KEY_DOWN, SERVER_CMD_KEY_UP: one byte with the key value (0-F);
+ * - SERVER_CMD_PAUSE, SERVER_CMD_RESUME, SERVER_CMD_STEP: no payload;
+ * - SERVER_CMD_SNAPSHOT: no payload;
+ * - SERVER_CMD_LOAD_ROM: big-endian 16-bit length followed by the ROM path.
+ *
+ * The server pushes messages, each starting with a message byte:
+ * - SERVER_MSG_ROW: row index byte followed by the row as a big-endian 64-bit
+ *   value, where the most-significant bit is the leftmost pixel. Only rows that
+ *   changed since the last frame sent to the client are pushed;
+ * - SERVER_MSG_WIDE_ROW: as SERVER_MSG_ROW, but with two 64-bit values for the
+ *   128 pixels of a high resolution (SUPER-CHIP, XO-CHIP) row. A change of
+ *   resolution resends every row. Lit pixels of any bitplane are set;
+ * - SERVER_MSG_STATE: V0-VF, I (16-bit BE), PC (16-bit BE), SP, DT and ST.
+ *   Sent in reply to SERVER_CMD_SNAPSHOT, preceded by every row of the frame.
+ *
+ * Socket I/O happens on the server's own thread. Commands reach the emulation
+ * thread through a lock-free single-producer single-consumer queue and frames
+ * travel the other way through a seqlock, so the emulation thread never blocks.
+ */
+
+enum ServerCommandType {
+    SERVER_CMD_KEY_DOWN = 1,
+    SERVER_CMD_KEY_UP,
+    SERVER_CMD_PAUSE,
+    SERVER_CMD_RESUME,
+    SERVER_CMD_STEP,
+    SERVER_CMD_SNAPSHOT,
+    SERVER_CMD_LOAD_ROM,
+};
+
+enum ServerMessageType {
+    SERVER_MSG_ROW = 1,
+    SERVER_MSG_STATE,
+    SERVER_MSG_WIDE_ROW,
+};
+
+#define SERVER_MAX_CLIENTS 8
+#define SERVER_QUEUE_SIZE  64 /* Must be a power of two */
+#define SERVER_MAX_PATH    256
+
+struct ServerCommand {
+    uint8_t type;
+    uint8_t key;
+    char path[SERVER_MAX_PATH];
+};
+
+//.. Machine state as published by the emulation thread
+struct ServerFrame {
+    uint64_t rows[DISPLAY_MAX_HEIGHT][DISPLAY_WORDS];
+    bool hires;
+    uint8_t data_registers[REGISTERS_SIZE];
+    uint16_t address_register;
+    uint16_t program_counter;
+    uint8_t stack_length;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint32_t snapshot_serial;
+};
+
+struct ServerClient {
+    int fd;
+    uint8_t input[3 + SERVER_MAX_PATH];
+    size_t input_length;
+    uint64_t sent_rows[DISPLAY_MAX_HEIGHT][DISPLAY_WORDS];
+    bool sent_hires;
+    bool synced;
+    bool wants_snapshot;
+};
+
+struct Server {
+    int listen_fd;
+    char socket_path[SERVER_MAX_PATH];
+    pthread_t thread;
+    bool running;
+
+    //.. Written by the server thread, read by the emulation thread
+    struct ServerCommand queue[SERVER_QUEUE_SIZE];
+    uint32_t queue_head;
+    //.. Written by the emulation thread, read by the server thread
+    uint32_t queue_tail;
+
+    //.. Published by the emulation thread, odd sequence while writing
+    struct ServerFrame frame;
+    uint32_t frame_sequence;
+
+    //.. Only touched by the server thread
+    struct ServerClient clients[SERVER_MAX_CLIENTS];
+    uint32_t snapshot_serial_sent;
+
+    //.. Only touched by the emulation thread
+    uint16_t held_keys;
+    bool paused;
+    unsigned int pending_steps;
+    uint32_t snapshot_serial;
+};
+
+enum Error server_start(struct Server*, const char* socket_path);
+void       server_process_commands(struct Server*, struct VM*);
+void       server_publish(struct Server*, const struct VM*);
+void       server_stop(struct Server*);
+
+#endif
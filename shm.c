@@ -0,0 +1,110 @@
+#define _DEFAULT_SOURCE
+
+#include "shm.h"
+#include "seqlock.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//.. `name` follows shm_open() rules, i.e. "/name" without further slashes.
+//   A segment of that name which already exists, e.g. one left behind by a
+//   crashed emulator, is only replaced with `replace`: it's unlinked, so that
+//   processes still reading it keep their mapping, and a new one is created.
+enum Error
+shm_export_open(struct ShmExport* shm, const char* name, bool replace)
+{
+    assert(CHIP8_SHM_DISPLAY_WIDTH == DISPLAY_MAX_WIDTH);
+    assert(CHIP8_SHM_DISPLAY_HEIGHT == DISPLAY_MAX_HEIGHT);
+    assert(CHIP8_SHM_DISPLAY_WORDS == DISPLAY_WORDS);
+    assert(CHIP8_SHM_DISPLAY_PLANES == DISPLAY_PLANES);
+
+    *shm = (struct ShmExport) { .state = NULL };
+    if (strlen(name) >= sizeof(shm->name))
+        return E_SHM_ERROR;
+    strcpy(shm->name, name);
+
+    if (replace)
+        shm_unlink(name);
+
+    //.. From here on the segment is ours to unlink
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return errno == EEXIST ? E_SHM_EXISTS : E_SHM_ERROR;
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || ftruncate(fd, sizeof(struct Chip8ShmState)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return E_SHM_ERROR;
+    }
+    shm->device = status.st_dev;
+    shm->inode = status.st_ino;
+
+    void* mapping = mmap(
+        NULL, sizeof(struct Chip8ShmState),
+        PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0
+    );
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name);
+        return E_SHM_ERROR;
+    }
+
+    shm->state = mapping;
+    memset(shm->state, 0, sizeof(struct Chip8ShmState));
+    shm->state->version = CHIP8_SHM_VERSION;
+    shm->state->size = sizeof(struct Chip8ShmState);
+    //.. Written last, readers treat the segment as invalid until then
+    __atomic_store_n(&shm->state->magic, CHIP8_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return E_OK;
+}
+
+//.. Write the current frame and registers to the segment. This is a plain
+//   memory copy, no system calls are made; the display is copied packed and
+//   left for readers to expand.
+void
+shm_export_publish(struct ShmExport* shm, const struct VM* vm)
+{
+    struct Chip8ShmState* state = shm->state;
+
+    seqlock_write_begin(&state->sequence);
+
+    state->frame_count = vm->frame_count;
+    memcpy(state->data_registers, vm->data_registers, REGISTERS_SIZE);
+    state->address_register = vm->address_register;
+    state->program_counter = vm->program_counter;
+    memcpy(state->stack, vm->stack.contents, sizeof(state->stack));
+    state->stack_length = vm->stack.length;
+    state->delay_timer = vm->delay_timer;
+    state->sound_timer = vm->sound_timer;
+
+    state->display_width = vm_display_width(vm);
+    state->display_height = vm_display_height(vm);
+    memcpy(state->display, vm->display, sizeof(state->display));
+
+    seqlock_write_end(&state->sequence);
+}
+
+//.. The segment is unlinked unless another emulator has replaced it by now
+void
+shm_export_close(struct ShmExport* shm)
+{
+    if (shm->state != NULL)
+        munmap(shm->state, sizeof(struct Chip8ShmState));
+
+    const int fd = shm_open(shm->name, O_RDONLY, 0);
+    if (fd < 0)
+        return;
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_dev == shm->device && status.st_ino == shm->inode)
+        shm_unlink(shm->name);
+    close(fd);
+}
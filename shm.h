@@ -0,0 +1,23 @@
+#ifndef SHM_H_
+#define SHM_H_
+
+#include "chip8_shm.h"
+#include "error.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct ShmExport {
+    char name[256];
+    struct Chip8ShmState* state;
+    //.. Of the segment created, to not unlink a replacement of it on close
+    dev_t device;
+    ino_t inode;
+};
+
+enum Error shm_export_open(struct ShmExport*, const char* name, bool replace);
+void       shm_export_publish(struct ShmExport*, const struct VM*);
+void       shm_export_close(struct ShmExport*);
+
+#endif
@@ -1,8 +1,12 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include "vm.h"
 #include "instructions.h"
+#include "hash.h"
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 enum Error
@@ -27,75 +31,131 @@ chip8stack_pop(struct Chip8Stack* cs, uint16_t* result)
     return E_OK;
 }
 
+//.. Fonts loaded into the first region of memory
+static const uint8_t FONT[] = {
+    /* 0 */ 0xF0, 0x90, 0x90, 0x90, 0xF0,
+    /* 1 */ 0x20, 0x60, 0x20, 0x20, 0x70,
+    /* 2 */ 0xF0, 0x10, 0xF0, 0x80, 0xF0,
+    /* 3 */ 0xF0, 0x10, 0xF0, 0x10, 0xF0,
+    /* 4 */ 0x90, 0x90, 0xF0, 0x10, 0x10,
+    /* 5 */ 0xF0, 0x80, 0xF0, 0x10, 0xF0,
+    /* 6 */ 0xF0, 0x80, 0xF0, 0x90, 0xF0,
+    /* 7 */ 0xF0, 0x10, 0x20, 0x40, 0x40,
+    /* 8 */ 0xF0, 0x90, 0xF0, 0x90, 0xF0,
+    /* 9 */ 0xF0, 0x90, 0xF0, 0x10, 0xF0,
+    /* A */ 0xF0, 0x90, 0xF0, 0x90, 0x90,
+    /* B */ 0xE0, 0x90, 0xE0, 0x90, 0xE0,
+    /* C */ 0xF0, 0x80, 0x80, 0x80, 0xF0,
+    /* D */ 0xE0, 0x90, 0x90, 0x90, 0xE0,
+    /* E */ 0xF0, 0x80, 0xF0, 0x80, 0xF0,
+    /* F */ 0xF0, 0x80, 0xF0, 0x80, 0x80,
+};
+
+//.. SUPER-CHIP's large 8x10 digits, loaded after the regular ones
+static const uint8_t BIG_FONT[] = {
+    /* 0 */ 0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,
+    /* 1 */ 0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,
+    /* 2 */ 0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,
+    /* 3 */ 0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,
+    /* 4 */ 0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,
+    /* 5 */ 0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,
+    /* 6 */ 0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,
+    /* 7 */ 0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,
+    /* 8 */ 0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,
+    /* 9 */ 0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C,
+    /* A */ 0x3C, 0x7E, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3,
+    /* B */ 0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC,
+    /* C */ 0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C,
+    /* D */ 0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,
+    /* E */ 0xFF, 0xFF, 0xC0, 0xC0, 0xFE, 0xFE, 0xC0, 0xC0, 0xFF, 0xFF,
+    /* F */ 0xFF, 0xFF, 0xC0, 0xC0, 0xFE, 0xFE, 0xC0, 0xC0, 0xC0, 0xC0,
+};
+
+//.. Power on a VM of `profile` in place, which must be allocated for at least
+//   vm_size(profile) bytes
+void
+vm_new(struct VM* vm, enum QuirkProfile profile)
+{
+    //.. For the RND instruction, xorshift32 must never be seeded with 0
+    vm->random_state = time(NULL) | 1;
+    vm->quirks = profile;
+    vm->snapshot_id = 0;
+    memset(vm->dirty_chunks, 0, sizeof(vm->dirty_chunks));
+    memset(vm->flag_registers, 0, sizeof(vm->flag_registers));
+
+    vm_reset(vm);
+}
+
+//.. Allocate a powered-on VM of `profile`, to be released with free()
 enum Error
-vm_new(struct VM* vm)
+vm_alloc(struct VM** vm, enum QuirkProfile profile)
 {
-    //.. For the RND instruction
-    srand(time(NULL));
-
-    *vm = (struct VM) {
-        .data_registers = {0},
-        .address_register = 0,
-        .delay_timer = 0,
-        .sound_timer = 0,
-        .program_counter = PROGRAM_START,
-        .stack = (struct Chip8Stack) {
-            .contents = {0},
-            .length = 0,
-        },
-        .memory = {
-            /* Load first regions of memory with fonts */
-            /* 0 */ 0xF0, 0x90, 0x90, 0x90, 0xF0,
-            /* 1 */ 0x20, 0x60, 0x20, 0x20, 0x70,
-            /* 2 */ 0xF0, 0x10, 0xF0, 0x80, 0xF0,
-            /* 3 */ 0xF0, 0x10, 0xF0, 0x10, 0xF0,
-            /* 4 */ 0x90, 0x90, 0xF0, 0x10, 0x10,
-            /* 5 */ 0xF0, 0x80, 0xF0, 0x10, 0xF0,
-            /* 6 */ 0xF0, 0x80, 0xF0, 0x90, 0xF0,
-            /* 7 */ 0xF0, 0x10, 0x20, 0x40, 0x40,
-            /* 8 */ 0xF0, 0x90, 0xF0, 0x90, 0xF0,
-            /* 9 */ 0xF0, 0x90, 0xF0, 0x10, 0xF0,
-            /* A */ 0xF0, 0x90, 0xF0, 0x90, 0x90,
-            /* B */ 0xE0, 0x90, 0xE0, 0x90, 0xE0,
-            /* C */ 0xF0, 0x80, 0x80, 0x80, 0xF0,
-            /* D */ 0xE0, 0x90, 0x90, 0x90, 0xE0,
-            /* E */ 0xF0, 0x80, 0xF0, 0x80, 0xF0,
-            /* F */ 0xF0, 0x80, 0xF0, 0x80, 0x80,
-        },
-    };
+    //.. Aligned for the hot block, see vm.h
+    if (posix_memalign((void**) vm, CACHE_LINE_SIZE, vm_size(profile)) != 0) {
+        *vm = NULL;
+        return E_OUT_OF_MEMORY;
+    }
 
-    return io_init(&vm->io);
+    vm_new(*vm, profile);
+    return E_OK;
 }
 
+//.. Put the machine back in its power-on state. The random number generator,
+//   the quirk profile and the SUPER-CHIP flag registers are kept.
 void
-vm_quit(struct VM* vm)
+vm_reset(struct VM* vm)
 {
-    io_quit(&vm->io);
+    memset(vm->data_registers, 0, sizeof(vm->data_registers));
+    vm->address_register = 0;
+    vm->delay_timer = 0;
+    vm->sound_timer = 0;
+    vm->keypad = 0;
+    vm->frame_count = 0;
+    vm->instruction_count = 0;
+    vm->rom_hash = hash_bytes(NULL, 0);
+    vm->program_counter = PROGRAM_START;
+    vm->stack = (struct Chip8Stack) {
+        .contents = {0},
+        .length = 0,
+    };
+
+    memset(vm->memory, 0, vm_memory_size(vm));
+    memcpy(&vm->memory[FONT_START], FONT, sizeof(FONT));
+    memcpy(&vm->memory[BIG_FONT_START], BIG_FONT, sizeof(BIG_FONT));
+    vm_mark_dirty(vm, 0, vm_memory_size(vm));
+
+    vm->hires = false;
+    vm->planes = 1;
+    memset(vm->audio_pattern, 0, sizeof(vm->audio_pattern));
+    vm->audio_pitch = 64; /* 4000 Hz */
+    memset(vm->display, 0, sizeof(vm->display));
+
+    hash_recompute(vm);
 }
 
 enum Error
 vm_insert_instruction(struct VM* vm, int16_t instruction)
 {
-    if (vm->program_counter + 2 > MEMORY_SIZE)
+    if (vm->program_counter + 2 > vm_memory_size(vm))
         return E_VM_OUT_OF_MEMORY;
 
     //.. Insert 16-bit instruction as two 8-bit values
-    vm->memory[vm->program_counter++] = instruction >> 8; /* Higher byte */
-    vm->memory[vm->program_counter++] = instruction & 0xFF; /* Lower byte */
+    hash_write_memory(vm, vm->program_counter++, instruction >> 8); /* Higher byte */
+    hash_write_memory(vm, vm->program_counter++, instruction & 0xFF); /* Lower byte */
 
     return E_OK;
 }
 
 void
-vm_print_debug(struct VM vm)
+vm_print_debug(const struct VM* vm)
 {
     puts("-------");
-    printf("Program Counter (PC): %d (0x%X)\n", vm.program_counter, vm.program_counter);
+    printf("Program Counter (PC): %d (0x%X)\n", vm->program_counter, vm->program_counter);
 
     for (uint8_t i = 0; i < REGISTERS_SIZE; i++)
-        printf("Register V%d = %d\n", i, vm.data_registers[i]);
+        printf("Register V%d = %d\n", i, vm->data_registers[i]);
 
-    printf("Address Register (I): %d (0x%X)\n", vm.address_register, vm.address_register);
+    printf("Address Register (I): %d (0x%X)\n", vm->address_register, vm->address_register);
     puts("--------");
 }
 
@@ -104,8 +164,29 @@ vm_print_debug(struct VM vm)
 #define THREE_NIBBLES_TO_12_BIT(higher_nibble, mid_nibble, lower_nibble)\
     ((higher_nibble << 8) + (mid_nibble << 4) + lower_nibble)
 
-static enum Error
-execute_opcode(struct VM* vm, uint16_t opcode)
+#define QUIRK_INSTRUCTIONS(profile, schip, xochip) {\
+        .shr = instruction_shr_##profile,\
+        .shl = instruction_shl_##profile,\
+        .jp_v0_addr = instruction_jp_v0_addr_##profile,\
+        .drw = instruction_drw_##profile,\
+        .ld_i_vx = instruction_ld_i_vx_##profile,\
+        .ld_vx_i = instruction_ld_vx_i_##profile,\
+        .schip_instructions = schip,\
+        .xochip_instructions = xochip,\
+        .memory_size = PROFILE_MEMORY_SIZE(xochip),\
+    }
+
+static const struct QuirkInstructions QUIRK_INSTRUCTIONS[] = {
+    [QUIRKS_MODERN] = QUIRK_INSTRUCTIONS(modern, false, false),
+    [QUIRKS_VIP] = QUIRK_INSTRUCTIONS(vip, false, false),
+    [QUIRKS_SCHIP] = QUIRK_INSTRUCTIONS(schip, true, false),
+    [QUIRKS_XOCHIP] = QUIRK_INSTRUCTIONS(xochip, true, true),
+};
+
+//.. Always inlined into the per-profile interpreters below with a constant
+//   `quirks`, so the quirk-dependent instructions become direct calls.
+static inline __attribute__((always_inline)) enum Error
+execute_opcode(struct VM* vm, uint16_t opcode, const struct QuirkInstructions* quirks)
 {
     //.. Nibbles where the highest nibble is the first etc.
     const uint4_t nibble_4 = opcode & 0xF;
@@ -115,9 +196,10 @@ execute_opcode(struct VM* vm, uint16_t opcode)
 
     /* Chip-8 instructions taken from http://devernay.free.fr/hacks/chip8/C8TECH10.HTM .
      *
-     * All opcodes can be split into six groups, depending on which nibble is variable:
+     * All opcodes can be split into seven groups, depending on which nibble is variable:
      * - A_NNN;
      * - A_B_C_D;
+     * - A_B_C_N;
      * - A_X_KK;
      * - A_X_Y_B;
      * - A_X_Y_N;
@@ -146,6 +228,12 @@ execute_opcode(struct VM* vm, uint16_t opcode)
                 return fn(vm);\
         } while (0);
 
+    #define CHECK_OPCODE_A_B_C_N(a, b, c, fn) \
+        do {\
+            if (nibble_1 == a && nibble_2 == b && nibble_3 == c)\
+                return fn(vm, nibble_4);\
+        } while (0);
+
      #define CHECK_OPCODE_A_X_KK(a, fn) \
         do {\
             if (nibble_1 == a) {\
@@ -182,6 +270,28 @@ execute_opcode(struct VM* vm, uint16_t opcode)
             }\
         } while (0);
 
+    //.. Extensions, the checks are compiled out of the other interpreters
+    if (quirks->xochip_instructions) {
+        CHECK_OPCODE_A_B_C_D(0xF, 0, 0, 0, instruction_ld_i_long);
+        CHECK_OPCODE_A_B_C_D(0xF, 0, 0, 2, instruction_audio);
+        CHECK_OPCODE_A_B_C_N(0, 0, 0xD, instruction_scu);
+        CHECK_OPCODE_A_X_B_C(0xF, 0, 1, instruction_plane);
+        CHECK_OPCODE_A_X_B_C(0xF, 3, 0xA, instruction_pitch);
+        CHECK_OPCODE_A_X_Y_B(5, 2, instruction_save_vx_vy);
+        CHECK_OPCODE_A_X_Y_B(5, 3, instruction_load_vx_vy);
+    }
+    if (quirks->schip_instructions) {
+        CHECK_OPCODE_A_B_C_D(0, 0, 0xF, 0xB, instruction_scr);
+        CHECK_OPCODE_A_B_C_D(0, 0, 0xF, 0xC, instruction_scl);
+        CHECK_OPCODE_A_B_C_D(0, 0, 0xF, 0xD, instruction_exit);
+        CHECK_OPCODE_A_B_C_D(0, 0, 0xF, 0xE, instruction_low);
+        CHECK_OPCODE_A_B_C_D(0, 0, 0xF, 0xF, instruction_high);
+        CHECK_OPCODE_A_B_C_N(0, 0, 0xC, instruction_scd);
+        CHECK_OPCODE_A_X_B_C(0xF, 3, 0, instruction_ld_hf_vx);
+        CHECK_OPCODE_A_X_B_C(0xF, 7, 5, instruction_ld_r_vx);
+        CHECK_OPCODE_A_X_B_C(0xF, 8, 5, instruction_ld_vx_r);
+    }
+
     //.. Note: list opcodes from least variables to most variables to prevent
     //   'collisions'.
     CHECK_OPCODE_A_B_C_D(0, 0, 0xE, 0, instruction_cls);
@@ -195,8 +305,8 @@ execute_opcode(struct VM* vm, uint16_t opcode)
     CHECK_OPCODE_A_X_B_C(0xF, 1, 0xE, instruction_add_i_vx);
     CHECK_OPCODE_A_X_B_C(0xF, 2, 9, instruction_ld_f_vx);
     CHECK_OPCODE_A_X_B_C(0xF, 3, 3, instruction_ld_b_vx);
-    CHECK_OPCODE_A_X_B_C(0xF, 5, 5, instruction_ld_i_vx);
-    CHECK_OPCODE_A_X_B_C(0xF, 6, 5, instructon_ld_vx_i);
+    CHECK_OPCODE_A_X_B_C(0xF, 5, 5, quirks->ld_i_vx);
+    CHECK_OPCODE_A_X_B_C(0xF, 6, 5, quirks->ld_vx_i);
     CHECK_OPCODE_A_X_Y_B(5, 0, instruction_se_vx_vy);
     CHECK_OPCODE_A_X_Y_B(8, 0, instruction_ld_vx_vy);
     CHECK_OPCODE_A_X_Y_B(8, 1, instruction_or);
@@ -204,77 +314,261 @@ execute_opcode(struct VM* vm, uint16_t opcode)
     CHECK_OPCODE_A_X_Y_B(8, 3, instruction_xor);
     CHECK_OPCODE_A_X_Y_B(8, 4, instruction_add_vx_vy);
     CHECK_OPCODE_A_X_Y_B(8, 5, instruction_sub);
-    CHECK_OPCODE_A_X_Y_B(8, 6, instruction_shr);
+    CHECK_OPCODE_A_X_Y_B(8, 6, quirks->shr);
     CHECK_OPCODE_A_X_Y_B(8, 7, instruction_subn);
-    CHECK_OPCODE_A_X_Y_B(8, 0xE, instruction_shl);
+    CHECK_OPCODE_A_X_Y_B(8, 0xE, quirks->shl);
     CHECK_OPCODE_A_X_Y_B(9, 0, instruction_sne_vx_vy);
     CHECK_OPCODE_A_X_KK(0xC, instruction_rnd);
     CHECK_OPCODE_A_X_KK(3, instruction_se_vx_byte);
     CHECK_OPCODE_A_X_KK(4, instruction_sne_vx_byte);
     CHECK_OPCODE_A_X_KK(6, instruction_ld_vx_byte);
     CHECK_OPCODE_A_X_KK(7, instruction_add_vx_byte);
-    CHECK_OPCODE_A_X_Y_N(0xD, instruction_drw);
+    CHECK_OPCODE_A_X_Y_N(0xD, quirks->drw);
     CHECK_OPCODE_A_NNN(1, instruction_jp_addr);
     CHECK_OPCODE_A_NNN(2, instruction_call);
     CHECK_OPCODE_A_NNN(0, instruction_sys);
-    CHECK_OPCODE_A_NNN(0xB, instruction_jp_v0_addr);
+    CHECK_OPCODE_A_NNN(0xB, quirks->jp_v0_addr);
     CHECK_OPCODE_A_NNN(0xA, instruction_ld_i_addr);
 
     return E_VM_UNKNOWN_UPCODE;
 }
 
 static uint16_t
-current_opcode(struct VM vm)
+current_opcode(const struct VM* vm)
 {
-    assert(vm.program_counter + 1 <= MEMORY_SIZE);
+    assert(vm->program_counter + 1 < vm_memory_size(vm));
 
-    return (vm.memory[vm.program_counter] << 8) + vm.memory[vm.program_counter + 1];
+    return (vm->memory[vm->program_counter] << 8) + vm->memory[vm->program_counter + 1];
 }
 
-enum Error
-vm_next(struct VM* vm, bool* quit_flag)
-{
-    SDL_Event event;
-    while (SDL_PollEvent(&event) != 0) {
-        switch (event.type) {
-        case SDL_QUIT:
-            *quit_flag = true;
-            return E_OK;
-        }
+//.. One specialised interpreter loop per quirk profile, the profile is only
+//   looked at once per call of run_instructions(). The instruction count is
+//   updated once per call as well, not per instruction.
+#define DEFINE_INTERPRETER(profile, quirk_profile) \
+    static enum Error\
+    run_instructions_##profile(struct VM* vm, unsigned int count)\
+    {\
+        enum Error err = E_OK;\
+        unsigned int i;\
+        for (i = 0; i < count; i++) {\
+            if (vm->program_counter + 1 >= QUIRK_INSTRUCTIONS[quirk_profile].memory_size) {\
+                err = E_VM_OUT_OF_MEMORY;\
+                break;\
+            }\
+            err = execute_opcode(\
+                vm, current_opcode(vm), &QUIRK_INSTRUCTIONS[quirk_profile]\
+            );\
+            if (err != E_OK)\
+                break;\
+        }\
+        vm->instruction_count += i;\
+        return err;\
     }
 
-    //.. Ring system bell when sound timer 'rings'
-    if (vm->sound_timer != 0 &&
-        vm->sound_timer_last_update + vm->sound_timer >= time(NULL)
-    ) {
-        io_beep();
-        vm->sound_timer = 0;
+DEFINE_INTERPRETER(modern, QUIRKS_MODERN)
+DEFINE_INTERPRETER(vip, QUIRKS_VIP)
+DEFINE_INTERPRETER(schip, QUIRKS_SCHIP)
+DEFINE_INTERPRETER(xochip, QUIRKS_XOCHIP)
+
+static enum Error
+run_instructions(struct VM* vm, unsigned int count)
+{
+    switch (vm->quirks) {
+    case QUIRKS_VIP:
+        return run_instructions_vip(vm, count);
+    case QUIRKS_SCHIP:
+        return run_instructions_schip(vm, count);
+    case QUIRKS_XOCHIP:
+        return run_instructions_xochip(vm, count);
+    case QUIRKS_MODERN:
+    default:
+        return run_instructions_modern(vm, count);
     }
-        
-    return execute_opcode(vm, current_opcode(*vm));
 }
 
 enum Error
-vm_insert_rom(struct VM* vm, const char* file_path)
+vm_step(struct VM* vm)
+{
+    return run_instructions(vm, 1);
+}
+
+enum Error
+vm_run_instructions(struct VM* vm, unsigned int count)
+{
+    return run_instructions(vm, count);
+}
+
+//.. Count the timers down at the end of a 60 Hz frame
+void
+vm_end_frame(struct VM* vm)
+{
+    if (vm->delay_timer > 0)
+        vm->delay_timer--;
+    if (vm->sound_timer > 0)
+        vm->sound_timer--;
+
+    vm->frame_count++;
+}
+
+//.. Run the instructions of one 60 Hz frame and count the timers down
+enum Error
+vm_run_frame(struct VM* vm)
+{
+    enum Error err = run_instructions(vm, INSTRUCTIONS_PER_FRAME);
+    if (err != E_OK)
+        return err;
+
+    vm_end_frame(vm);
+    return E_OK;
+}
+
+//.. xorshift32, kept in the VM so that snapshots include it
+uint8_t
+vm_random(struct VM* vm)
+{
+    uint32_t x = vm->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    vm->random_state = x;
+
+    return x >> 24;
+}
+
+//.. Copy a ROM image into memory at the program start. It has to fit in the
+//   memory of the machine's profile.
+enum Error
+vm_load_rom(struct VM* vm, const uint8_t* rom, size_t size)
 {
+    if (size > (size_t) vm_memory_size(vm) - PROGRAM_START)
+        return E_VM_OUT_OF_MEMORY;
+
+    for (size_t i = 0; i < size; i++)
+        hash_write_memory(vm, PROGRAM_START + i, rom[i]);
+
+    vm->rom_hash = hash_bytes(rom, size);
+    return E_OK;
+}
+
+//.. Read a ROM image, e.g. to pick the quirk profile by its hash before
+//   loading it. Images that fit no profile's memory are refused.
+enum Error
+vm_read_rom(const char* file_path, struct Rom* rom)
+{
+    *rom = (struct Rom) { .bytes = NULL };
+
     FILE* file = fopen(file_path, "rb");
     if (file == NULL)
         return E_COULDNT_OPEN_FILE;
 
+    enum Error err = E_OK;
     fseek(file, 0, SEEK_END);
     long file_size = ftell(file);
     rewind(file);
 
-    if (file_size > (MEMORY_SIZE - 0x200)) {
-        fclose(file);
-        return E_VM_OUT_OF_MEMORY;
+    if (file_size > (MEMORY_SIZE - PROGRAM_START)) {
+        err = E_VM_OUT_OF_MEMORY;
+        goto cleanup;
     }
 
-    if (!fread(&vm->memory[0x200], sizeof(uint8_t), file_size, file)) {
+    rom->bytes = malloc(file_size > 0 ? file_size : 1);
+    if (rom->bytes == NULL) {
+        err = E_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    if (file_size <= 0 || fread(rom->bytes, sizeof(uint8_t), file_size, file) != (size_t) file_size) {
+        vm_free_rom(rom);
+        err = E_COULDNT_READ_FILE;
+        goto cleanup;
+    }
+
+    rom->size = file_size;
+    rom->hash = hash_bytes(rom->bytes, rom->size);
+
+    cleanup:
         fclose(file);
-        return E_COULDNT_READ_FILE;
+        return err;
+}
+
+void
+vm_free_rom(struct Rom* rom)
+{
+    free(rom->bytes);
+    rom->bytes = NULL;
+}
+
+enum Error
+vm_insert_rom(struct VM* vm, const char* file_path)
+{
+    struct Rom rom;
+    enum Error err = vm_read_rom(file_path, &rom);
+    if (err != E_OK)
+        return err;
+
+    err = vm_load_rom(vm, rom.bytes, rom.size);
+    vm_free_rom(&rom);
+    return err;
+}
+
+//.. Copy the memory chunks in `chunks` from `source` to `destination`, as far
+//   as the memory of `source` reaches. Both memory sizes are whole chunks.
+static void
+copy_chunks(struct VM* destination, const struct VM* source,
+            const uint64_t chunks[DIRTY_WORDS])
+{
+    const size_t memory_size = vm_memory_size(source);
+
+    for (size_t word = 0; word < DIRTY_WORDS; word++) {
+        for (uint64_t bits = chunks[word]; bits != 0; bits &= bits - 1) {
+            const size_t offset =
+                (word * 64 + __builtin_ctzll(bits)) * MEMORY_CHUNK_SIZE;
+            if (offset >= memory_size)
+                return;
+            memcpy(&destination->memory[offset], &source->memory[offset], MEMORY_CHUNK_SIZE);
+        }
     }
+}
 
-    fclose(file);
-    return E_OK;
+void
+vm_snapshot(struct VM* vm, struct VM* snapshot)
+{
+    static uint64_t last_snapshot_id = 0;
+
+    vm->snapshot_id = __atomic_add_fetch(&last_snapshot_id, 1, __ATOMIC_RELAXED);
+    memset(vm->dirty_chunks, 0, sizeof(vm->dirty_chunks));
+    memcpy(snapshot, vm, vm_size(vm->quirks));
+}
+
+void
+vm_restore(struct VM* vm, const struct VM* snapshot)
+{
+    if (vm->snapshot_id != snapshot->snapshot_id || vm->snapshot_id == 0) {
+        memcpy(vm, snapshot, vm_size(snapshot->quirks));
+        return;
+    }
+
+    uint64_t dirty_chunks[DIRTY_WORDS];
+    memcpy(dirty_chunks, vm->dirty_chunks, sizeof(dirty_chunks));
+
+    //.. Everything in front of memory, which includes the clean dirty set
+    memcpy(vm, snapshot, offsetof(struct VM, memory));
+    copy_chunks(vm, snapshot, dirty_chunks);
+}
+
+void
+vm_fork(struct VM* child, const struct VM* parent)
+{
+    if (child->snapshot_id != parent->snapshot_id || child->snapshot_id == 0) {
+        memcpy(child, parent, vm_size(parent->quirks));
+        return;
+    }
+
+    //.. Outside of the chunks dirty in either, both still equal the snapshot
+    uint64_t chunks[DIRTY_WORDS];
+    for (size_t word = 0; word < DIRTY_WORDS; word++)
+        chunks[word] = child->dirty_chunks[word] | parent->dirty_chunks[word];
+
+    memcpy(child, parent, offsetof(struct VM, memory));
+    copy_chunks(child, parent, chunks);
 }
@@ -2,19 +2,50 @@
 #define VM_H_
 
 #include "error.h"
-#include "io.h"
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 enum Register {
     V0, V1, V2, V3, V4, V5, V6, V7, V8, V9, VA, VB, VC, VD, VE, VF
 };
 #define REGISTERS_SIZE 16
-#define MEMORY_SIZE    0xFFF
+#define MEMORY_SIZE    0x10000 /* XO-CHIP, see vm_memory_size() */
+#define CHIP8_MEMORY_SIZE 0x1000 /* CHIP-8 and SUPER-CHIP */
 #define STACK_SIZE     16
 #define PROGRAM_START  0x200
 #define FONT_START     0x0
+#define BIG_FONT_START 0x50 /* SUPER-CHIP 8x10 digits */
+#define FLAG_REGISTERS 16   /* SUPER-CHIP RPL user flags */
+#define AUDIO_PATTERN_SIZE 16
+
+//.. Writes to memory are tracked per chunk, so that a snapshot can be restored
+//   by copying back only the chunks which changed, see vm_restore()
+#define MEMORY_CHUNK_SIZE 64
+#define MEMORY_CHUNKS     ((MEMORY_SIZE + MEMORY_CHUNK_SIZE - 1) / MEMORY_CHUNK_SIZE)
+#define DIRTY_WORDS       ((MEMORY_CHUNKS + 63) / 64)
+
+//.. Low resolution, SUPER-CHIP and XO-CHIP can switch to double that. The
+//   display is kept as rows of packed 64-bit words per bitplane.
+#define DISPLAY_WIDTH      64
+#define DISPLAY_HEIGHT     32
+#define DISPLAY_MAX_WIDTH  (2 * DISPLAY_WIDTH)
+#define DISPLAY_MAX_HEIGHT (2 * DISPLAY_HEIGHT)
+#define DISPLAY_WORDS      (DISPLAY_MAX_WIDTH / 64)
+#define DISPLAY_PLANES     2
+
+//.. Timers count down at 60 Hz, the machine executes a fixed number of
+//   instructions in between.
+#define INSTRUCTIONS_PER_FRAME 11
+
+//.. Behaviours on which interpreters disagree, see instructions.c
+enum QuirkProfile {
+    QUIRKS_MODERN,
+    QUIRKS_VIP,   /* COSMAC VIP */
+    QUIRKS_SCHIP, /* SUPER-CHIP, enables its instructions */
+    QUIRKS_XOCHIP, /* XO-CHIP, enables SUPER-CHIP's and its own instructions */
+};
 
 struct Chip8Stack {
     uint16_t contents[STACK_SIZE];
@@ -23,26 +54,150 @@ struct Chip8Stack {
 enum Error chip8stack_push(struct Chip8Stack*, uint16_t);
 enum Error chip8stack_pop(struct Chip8Stack*, uint16_t*);
 
+//.. The complete machine state. It holds no pointers or handles, so a VM can
+//   be snapshotted and restored by copying its bytes; the frontend in io.h is
+//   kept separately. Memory is kept last, vm_restore() copies everything in
+//   front of it in one go.
+//
+//   Memory is sized by the profile: a VM takes vm_size() bytes, which for
+//   CHIP-8 and SUPER-CHIP holds 4 KB of memory and for XO-CHIP 64 KB. VMs are
+//   therefore allocated with vm_alloc() rather than declared, and a VM of one
+//   profile can't be switched to XO-CHIP unless it has room for its memory.
+//
+//   What the interpreter touches on every instruction comes first, in a hot
+//   block of VM_HOT_BLOCK_SIZE bytes at the start of a cache line, so that it
+//   stays in two lines however far apart instances lie. Memory starts on a
+//   cache line as well, its dirty chunks then coincide with lines.
+#define CACHE_LINE_SIZE   64
+#define VM_HOT_BLOCK_SIZE (2 * CACHE_LINE_SIZE)
+
 struct VM {
+    //.. Hot block
     uint8_t data_registers[REGISTERS_SIZE];
     uint16_t address_register;
     uint16_t program_counter;
-    struct Chip8Stack stack;
-    struct IO io;
-
     uint8_t delay_timer;
-    unsigned long delay_timer_last_update;
     uint8_t sound_timer;
-    unsigned long sound_timer_last_update;
+    //.. Keys currently held down, bit n corresponds with key value n
+    uint16_t keypad;
+    uint32_t random_state;
+    uint8_t quirks; /* enum QuirkProfile */
+    bool hires;
+    uint8_t planes; /* Bitplanes drawn to, bit n for plane n */
+    //.. Incrementally maintained parts of the state hash, see hash.h
+    uint64_t state_hash;
+    uint64_t pixel_hash;
+    //.. Instructions executed since power-on, read by the metrics in metrics.h
+    uint64_t instruction_count;
+    unsigned long frame_count;
+    struct Chip8Stack stack;
+
+    uint64_t rom_hash;
+
+    //.. SUPER-CHIP and XO-CHIP extensions
+    uint8_t flag_registers[FLAG_REGISTERS];
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint8_t audio_pitch;
+
+    //.. Snapshot this state descends from (0 for none) and the memory chunks
+    //   written since, bit n of the set corresponds with chunk n
+    uint64_t snapshot_id;
+    uint64_t dirty_chunks[DIRTY_WORDS];
+
+    //.. The leftmost pixel of a row is the most-significant bit of its first
+    //   word. In low resolution only the first word and DISPLAY_HEIGHT rows
+    //   are used.
+    uint64_t display[DISPLAY_PLANES][DISPLAY_MAX_HEIGHT][DISPLAY_WORDS];
 
-    uint8_t memory[MEMORY_SIZE];
+    uint8_t memory[] __attribute__((aligned(CACHE_LINE_SIZE)));
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+//.. Fails to compile when the hot block outgrows its lines
+typedef char vm_hot_block_fits[
+    offsetof(struct VM, rom_hash) <= VM_HOT_BLOCK_SIZE ? 1 : -1
+];
+
+//.. Memory a profile can address, past it the machine runs out of memory
+#define PROFILE_MEMORY_SIZE(xochip) ((xochip) ? MEMORY_SIZE : CHIP8_MEMORY_SIZE)
+
+static inline int
+vm_memory_size(const struct VM* vm)
+{
+    return PROFILE_MEMORY_SIZE(vm->quirks == QUIRKS_XOCHIP);
+}
+
+//.. Bytes a VM of `profile` takes, its state and the memory it addresses
+static inline size_t
+vm_size(enum QuirkProfile profile)
+{
+    return offsetof(struct VM, memory) + PROFILE_MEMORY_SIZE(profile == QUIRKS_XOCHIP);
+}
+
+static inline unsigned int
+vm_display_width(const struct VM* vm)
+{
+    return vm->hires ? DISPLAY_MAX_WIDTH : DISPLAY_WIDTH;
+}
+
+static inline unsigned int
+vm_display_height(const struct VM* vm)
+{
+    return vm->hires ? DISPLAY_MAX_HEIGHT : DISPLAY_HEIGHT;
+}
+
+//.. Colour of a pixel, bit n is set when it is lit in plane n
+static inline uint8_t
+vm_pixel(const struct VM* vm, unsigned int row, unsigned int column)
+{
+    const unsigned int word = column / 64;
+    const unsigned int bit = 63 - column % 64;
+
+    return ((vm->display[0][row][word] >> bit) & 1) |
+           (((vm->display[1][row][word] >> bit) & 1) << 1);
+}
+
+//.. Every write to memory has to pass through here (hash_write_memory() does)
+//   or it is missed by vm_restore()
+static inline void
+vm_mark_dirty(struct VM* vm, uint16_t address, size_t length)
+{
+    if (length == 0)
+        return;
+
+    const size_t last = (address + length - 1) / MEMORY_CHUNK_SIZE;
+    for (size_t chunk = address / MEMORY_CHUNK_SIZE; chunk <= last; chunk++)
+        vm->dirty_chunks[chunk / 64] |= 1ULL << (chunk % 64);
+}
+
+struct Rom {
+    uint8_t* bytes;
+    size_t size;
+    uint64_t hash; /* See hash_bytes() */
 };
 
-enum Error vm_new(struct VM*);
+void       vm_new(struct VM*, enum QuirkProfile);
+enum Error vm_alloc(struct VM**, enum QuirkProfile);
+void       vm_reset(struct VM*);
 enum Error vm_insert_instruction(struct VM*, int16_t);
-void       vm_print_debug(struct VM);
-enum Error vm_next(struct VM*, bool*);
+void       vm_print_debug(const struct VM*);
+enum Error vm_step(struct VM*);
+enum Error vm_run_instructions(struct VM*, unsigned int count);
+void       vm_end_frame(struct VM*);
+enum Error vm_run_frame(struct VM*);
+uint8_t    vm_random(struct VM*);
+enum Error vm_load_rom(struct VM*, const uint8_t*, size_t);
+enum Error vm_read_rom(const char*, struct Rom*);
+void       vm_free_rom(struct Rom*);
 enum Error vm_insert_rom(struct VM*, const char*);
-void       vm_quit(struct VM*);
+
+//.. Copy-on-write style snapshots for fuzzing and searches. vm_snapshot()
+//   makes `vm` a descendant of the new snapshot. vm_restore() returns a
+//   descendant to the snapshot by copying back only the dirty memory chunks,
+//   vm_fork() clones a live VM, likewise cheaply if both share a snapshot.
+//   Either falls back to a full copy for unrelated VMs. The copy has to be
+//   allocated for at least the profile of the VM it is copied from.
+void vm_snapshot(struct VM* vm, struct VM* snapshot);
+void vm_restore(struct VM* vm, const struct VM* snapshot);
+void vm_fork(struct VM* child, const struct VM* parent);
 
 #endif